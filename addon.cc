@@ -1,9 +1,59 @@
 #include <napi.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
-#include <iostream>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <functional>
+#include <cstdlib>
+#include <cstdio>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <thread>
+#include <deque>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <condition_variable>
+#include <initializer_list>
+#include <fstream>
+#include <filesystem>
 #include "curl/curl.h"
+// USDT probes for perf/bpftrace, compiled in with -Dcurlnapi_usdt=1 (see
+// binding.gyp). A probe site is a single nop until a tracer attaches; the
+// semaphores let the addon skip installing a progress callback when the
+// phase probes have no listener.
+#if defined(CURLNAPI_USDT) && defined(__linux__)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define CURLNAPI_SEMAPHORE(name) extern "C" { __attribute__((section(".probes"))) unsigned short curlnapi_##name##_semaphore; }
+CURLNAPI_SEMAPHORE(request__start)
+CURLNAPI_SEMAPHORE(dns__done)
+CURLNAPI_SEMAPHORE(connect__done)
+CURLNAPI_SEMAPHORE(tls__done)
+CURLNAPI_SEMAPHORE(first__byte)
+CURLNAPI_SEMAPHORE(body__chunk)
+CURLNAPI_SEMAPHORE(request__done)
+CURLNAPI_SEMAPHORE(js__resolve)
+#define CURLNAPI_PROBE_ENABLED(name) (*(volatile unsigned short*)&curlnapi_##name##_semaphore != 0)
+#define CURLNAPI_PROBE3(name, a, b, c) DTRACE_PROBE3(curlnapi, name, a, b, c)
+#define CURLNAPI_PROBE4(name, a, b, c, d) DTRACE_PROBE4(curlnapi, name, a, b, c, d)
+#define CURLNAPI_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(curlnapi, name, a, b, c, d, e)
+#else
+#define CURLNAPI_PROBE_ENABLED(name) false
+#define CURLNAPI_PROBE3(name, a, b, c) do {} while (0)
+#define CURLNAPI_PROBE4(name, a, b, c, d) do {} while (0)
+#define CURLNAPI_PROBE5(name, a, b, c, d, e) do {} while (0)
+#endif
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
 static void trim(std::string& s) {
   s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch){ return !std::isspace(ch); }));
   while (!s.empty() && std::isspace((unsigned char)s.back())) s.pop_back();
@@ -35,210 +85,4151 @@ static bool sanitizeHeaderKV(std::string& key, std::string& val) {
   return !key.empty() && !val.empty();
 }
 
+// Request header names the addon looks for, matched case-insensitively
+// against a static table without allocating.
+enum KnownHeader {
+  kHdrUnknown = -1,
+  kHdrUserAgent,
+  kHdrReferer,
+  kHdrCount
+};
+static const std::string_view kKnownHeaderNames[kHdrCount] = { "user-agent", "referer" };
+
+static int knownHeader(std::string_view k) {
+  for (int i = 0; i < kHdrCount; ++i) {
+    std::string_view n = kKnownHeaderNames[i];
+    if (n.size() != k.size()) continue;
+    size_t j = 0;
+    while (j < n.size() && std::tolower((unsigned char)k[j]) == n[j]) ++j;
+    if (j == n.size()) return i;
+  }
+  return kHdrUnknown;
+}
+
+// A preencoded header block: "Name: value" lines split by CRLF or LF.
+static void parseHeaderBlock(const char* p, size_t n, std::vector<std::pair<std::string,std::string>>& out) {
+  const char* end = p + n;
+  while (p < end) {
+    const char* eol = (const char*)memchr(p, '\n', end - p);
+    if (!eol) eol = end;
+    const char* colon = (const char*)memchr(p, ':', eol - p);
+    if (colon) {
+      std::string k(p, colon);
+      std::string v(colon + 1, eol);
+      if (sanitizeHeaderKV(k, v)) out.emplace_back(std::move(k), std::move(v));
+    }
+    p = eol + 1;
+  }
+}
+
 static size_t write_cb(char* ptr, size_t size, size_t nmemb, void* userdata) {
   std::string* s = reinterpret_cast<std::string*>(userdata);
   s->append(ptr, size * nmemb);
   return size * nmemb;
 }
 
+// Response headers kept as one raw block plus offsets into it. A status
+// line starts a new response (a redirect hop or an interim 1xx), so only
+// the final one is kept.
 struct HeaderCollector {
-  std::vector<std::pair<std::string, std::string>> headers;
+  struct Field {
+    uint32_t name, nameLen, value, valueLen;
+  };
+  std::string raw;
+  std::vector<Field> fields;
+  uint32_t reasonLen{0};
+  char version[4]{};
+
+  void clear() {
+    raw.clear();
+    fields.clear();
+    reasonLen = 0;
+    version[0] = 0;
+  }
+  size_t size() const { return fields.size(); }
+  std::string_view name(size_t i) const { return std::string_view(raw.data() + fields[i].name, fields[i].nameLen); }
+  std::string_view value(size_t i) const { return std::string_view(raw.data() + fields[i].value, fields[i].valueLen); }
+  // The reason phrase sits at the start of the block.
+  std::string_view reason() const { return std::string_view(raw.data(), reasonLen); }
+};
+
+static bool headerSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+static size_t header_cb(char* buffer, size_t size, size_t nitems, void* userdata) {
+  size_t len = size * nitems;
+  HeaderCollector* hc = (HeaderCollector*)userdata;
+  const char* p = buffer;
+  const char* end = buffer + len;
+  while (end > p && headerSpace(end[-1])) --end;
+  if (end - p >= 5 && memcmp(p, "HTTP/", 5) == 0) {
+    hc->clear();
+    const char* v = p + 5;
+    const char* sp = (const char*)memchr(v, ' ', end - v);
+    if (!sp) return len;
+    size_t vl = std::min<size_t>(sp - v, sizeof(hc->version) - 1);
+    memcpy(hc->version, v, vl);
+    hc->version[vl] = 0;
+    const char* code = sp + 1;
+    const char* reason = (const char*)memchr(code, ' ', end - code);
+    if (reason) {
+      hc->raw.assign(reason + 1, end);
+      hc->reasonLen = (uint32_t)hc->raw.size();
+    }
+    return len;
+  }
+  const char* colon = (const char*)memchr(p, ':', end - p);
+  if (!colon) return len;
+  while (p < colon && headerSpace(*p)) ++p;
+  const char* ne = colon;
+  while (ne > p && headerSpace(ne[-1])) --ne;
+  const char* v = colon + 1;
+  while (v < end && headerSpace(*v)) ++v;
+  HeaderCollector::Field f;
+  f.name = (uint32_t)hc->raw.size();
+  f.nameLen = (uint32_t)(ne - p);
+  hc->raw.append(p, ne);
+  f.value = (uint32_t)hc->raw.size();
+  f.valueLen = (uint32_t)(end - v);
+  hc->raw.append(v, end);
+  hc->fields.push_back(f);
+  return len;
+}
+
+static std::string normalizeBrowser(const std::string& b) {
+  if (b == "Chrome" || b == "chrome") return "chrome142";
+  if (b == "Firefox" || b == "firefox") return "firefox144";
+  return b;
+}
+
+static std::string ensureProxyScheme(const std::string& u) {
+  if (u.rfind("http://", 0) == 0 || u.rfind("https://", 0) == 0 || u.rfind("socks5://", 0) == 0 || u.rfind("socks5h://", 0) == 0 || u.rfind("socks4://", 0) == 0 || u.rfind("socks4a://", 0) == 0) {
+    return u;
+  }
+  return std::string("http://") + u;
+}
+
+static int64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Strips "user:pass@" so credentials never leak through stats.
+static std::string redactProxy(const std::string& u) {
+  size_t s = u.find("://");
+  s = (s == std::string::npos) ? 0 : s + 3;
+  size_t at = u.find('@', s);
+  if (at == std::string::npos || u.find('/', s) < at) return u;
+  return u.substr(0, s) + u.substr(at + 1);
+}
+
+// A connect-phase failure never put the request on the wire, so it is safe
+// to replay it through another proxy whatever the method. Once a CONNECT
+// tunnel is up, failures are the origin's, its own TLS handshake included.
+static bool isProxyFailure(CURL* curl, CURLcode rc) {
+  curl_off_t pretransfer = 0;
+  long tunnel = 0;
+  curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  curl_easy_getinfo(curl, CURLINFO_HTTP_CONNECTCODE, &tunnel);
+  if (pretransfer > 0 || (tunnel >= 200 && tunnel < 300)) return false;
+  switch (rc) {
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_PROXY:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_GOT_NOTHING:
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct ProxyEntry {
+  std::string url;
+  uint64_t successes{0};
+  uint64_t failures{0};
+  uint32_t consecutiveFailures{0};
+  uint32_t inflight{0};
+  double latencyMs{0};   // EWMA of fresh connect times
+  double health{1.0};    // EWMA of success (1) / connect failure (0)
+  int64_t bannedUntil{0};
+};
+
+class ProxyPool {
+public:
+  enum class Strategy { RoundRobin, LeastLatency, Sticky };
+
+  bool empty() const { return entries.empty(); }
+
+  void add(const std::string& u) {
+    ProxyEntry e;
+    e.url = ensureProxyScheme(u);
+    entries.push_back(e);
+  }
+
+  void setStrategy(const std::string& s) {
+    if (s == "least-latency") strategy = Strategy::LeastLatency;
+    else if (s == "sticky") strategy = Strategy::Sticky;
+    else strategy = Strategy::RoundRobin;
+  }
+
+  // Picks a proxy not listed in `tried`. Banned proxies are only handed out
+  // when every candidate is banned, preferring the one whose ban ends first.
+  int acquire(const std::string& session, const std::vector<int>& tried) {
+    std::lock_guard<std::mutex> lock(mu);
+    int64_t now = nowMs();
+    auto usable = [&](size_t i) {
+      return std::find(tried.begin(), tried.end(), (int)i) == tried.end();
+    };
+    auto healthy = [&](size_t i) { return usable(i) && entries[i].bannedUntil <= now; };
+    int pick = -1;
+    size_t n = entries.size();
+    if (strategy == Strategy::Sticky && !session.empty()) {
+      // Hashing keeps the mapping stateless; a banned home proxy hands its
+      // sessions to the next healthy one until the ban expires.
+      size_t start = std::hash<std::string>{}(session) % n;
+      for (size_t k = 0; k < n && pick < 0; ++k) {
+        if (healthy((start + k) % n)) pick = (int)((start + k) % n);
+      }
+    } else if (strategy == Strategy::LeastLatency) {
+      double best = 0;
+      for (size_t i = 0; i < n; ++i) {
+        if (!healthy(i)) continue;
+        // Unmeasured proxies sort first so each one gets sampled.
+        double cost = (entries[i].latencyMs + 1.0) * (1 + entries[i].inflight) / std::max(entries[i].health, 0.05);
+        if (pick < 0 || cost < best) { pick = (int)i; best = cost; }
+      }
+    }
+    for (size_t k = 0; k < n && pick < 0; ++k) {
+      size_t i = (cursor + k) % n;
+      if (healthy(i)) { pick = (int)i; cursor = i + 1; }
+    }
+    if (pick < 0) {
+      for (size_t i = 0; i < n; ++i) {
+        if (usable(i) && (pick < 0 || entries[i].bannedUntil < entries[pick].bannedUntil)) pick = (int)i;
+      }
+    }
+    if (pick >= 0) entries[pick].inflight++;
+    return pick;
+  }
+
+  void release(int idx, bool ok, double connectMs) {
+    std::lock_guard<std::mutex> lock(mu);
+    ProxyEntry& e = entries[idx];
+    if (e.inflight > 0) e.inflight--;
+    if (ok) {
+      e.successes++;
+      e.consecutiveFailures = 0;
+      e.health = e.health * 0.8 + 0.2;
+      if (connectMs > 0) e.latencyMs = e.latencyMs == 0 ? connectMs : e.latencyMs * 0.8 + connectMs * 0.2;
+    } else {
+      e.failures++;
+      e.consecutiveFailures++;
+      e.health = e.health * 0.8;
+      // Back off exponentially while the proxy keeps failing.
+      int64_t ban = banMs << std::min<uint32_t>(e.consecutiveFailures - 1, 5);
+      e.bannedUntil = nowMs() + ban;
+    }
+  }
+
+  std::string url(int idx) const { return entries[idx].url; }
+
+  Napi::Array stats(Napi::Env env) {
+    std::lock_guard<std::mutex> lock(mu);
+    int64_t now = nowMs();
+    Napi::Array arr = Napi::Array::New(env, entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const ProxyEntry& e = entries[i];
+      Napi::Object o = Napi::Object::New(env);
+      o.Set("url", Napi::String::New(env, redactProxy(e.url)));
+      o.Set("successes", Napi::Number::New(env, (double)e.successes));
+      o.Set("failures", Napi::Number::New(env, (double)e.failures));
+      o.Set("inflight", Napi::Number::New(env, e.inflight));
+      o.Set("latencyMs", Napi::Number::New(env, e.latencyMs));
+      o.Set("score", Napi::Number::New(env, e.health));
+      o.Set("banned", Napi::Boolean::New(env, e.bannedUntil > now));
+      o.Set("bannedForMs", Napi::Number::New(env, (double)std::max<int64_t>(0, e.bannedUntil - now)));
+      arr.Set((uint32_t)i, o);
+    }
+    return arr;
+  }
+
+  int64_t banMs{30000};
+  uint32_t maxRetries{2};
+
+private:
+  std::vector<ProxyEntry> entries;
+  Strategy strategy{Strategy::RoundRobin};
+  size_t cursor{0};
+  std::mutex mu;
+};
+
+// Failures that say the endpoint is unreachable, as opposed to a bad
+// response from a reachable one.
+static bool isConnectFailure(CURLcode rc) {
+  switch (rc) {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Classic closed/open/half-open breakers keyed by origin or proxy. Only
+// keys with recent failures have an entry, so the map stays small.
+class CircuitBreakers {
+public:
+  enum Verdict { kAllow, kProbe, kReject };
+  enum Outcome { kSuccess, kFailure, kNeutral };
+
+  Verdict admit(const std::string& key, int64_t& retryInMs) {
+    std::lock_guard<std::mutex> lock(mu);
+    auto it = entries.find(key);
+    if (it == entries.end()) return kAllow;
+    Entry& e = it->second;
+    if (e.state == kClosed) return kAllow;
+    int64_t now = nowMs();
+    if (e.state == kOpen) {
+      if (now < e.openedAt + resetMs) {
+        retryInMs = e.openedAt + resetMs - now;
+        return kReject;
+      }
+      e.state = kHalfOpen;
+      e.probes = 0;
+    }
+    if (e.probes >= halfOpenProbes) {
+      retryInMs = 0;
+      return kReject;
+    }
+    e.probes++;
+    return kProbe;
+  }
+
+  void record(const std::string& key, bool probe, Outcome outcome, CURLcode rc) {
+    std::lock_guard<std::mutex> lock(mu);
+    auto it = entries.find(key);
+    if (outcome == kSuccess) {
+      if (it != entries.end() && (probe || it->second.state == kClosed)) entries.erase(it);
+      return;
+    }
+    if (outcome == kNeutral) {
+      if (probe && it != entries.end() && it->second.probes > 0) it->second.probes--;
+      return;
+    }
+    Entry& e = it != entries.end() ? it->second : entries[key];
+    e.failures++;
+    e.lastError = rc;
+    if (probe || (e.state == kClosed && e.failures >= threshold)) {
+      e.state = kOpen;
+      e.openedAt = nowMs();
+      e.probes = 0;
+    }
+  }
+
+  Napi::Object stats(Napi::Env env) {
+    static const char* const kStateNames[] = { "closed", "open", "halfOpen" };
+    std::lock_guard<std::mutex> lock(mu);
+    Napi::Object out = Napi::Object::New(env);
+    int64_t now = nowMs();
+    for (auto& kv : entries) {
+      const Entry& e = kv.second;
+      Napi::Object o = Napi::Object::New(env);
+      o.Set("state", Napi::String::New(env, kStateNames[e.state]));
+      o.Set("failures", Napi::Number::New(env, e.failures));
+      o.Set("retryInMs", Napi::Number::New(env, e.state == kOpen ? (double)std::max<int64_t>(0, e.openedAt + resetMs - now) : 0));
+      o.Set("lastError", Napi::String::New(env, curl_easy_strerror(e.lastError)));
+      out.Set(kv.first, o);
+    }
+    return out;
+  }
+
+  uint32_t threshold{5};
+  uint32_t resetMs{30000};
+  uint32_t halfOpenProbes{1};
+
+private:
+  enum State { kClosed, kOpen, kHalfOpen };
+  struct Entry {
+    State state{kClosed};
+    uint32_t failures{0};
+    uint32_t probes{0};
+    int64_t openedAt{0};
+    CURLcode lastError{CURLE_OK};
+  };
+
+  std::map<std::string, Entry> entries;
+  std::mutex mu;
+};
+
+// Lowercased host of an absolute URL, without userinfo, port or brackets.
+static std::string urlHost(const std::string& url) {
+  size_t p = url.find("://");
+  size_t s = (p == std::string::npos) ? 0 : p + 3;
+  size_t e = url.find_first_of("/?#", s);
+  std::string host = url.substr(s, e == std::string::npos ? std::string::npos : e - s);
+  size_t at = host.rfind('@');
+  if (at != std::string::npos) host = host.substr(at + 1);
+  if (!host.empty() && host[0] == '[') {
+    size_t rb = host.find(']');
+    host = host.substr(1, rb == std::string::npos ? std::string::npos : rb - 1);
+  } else {
+    size_t c = host.find(':');
+    if (c != std::string::npos) host = host.substr(0, c);
+  }
+  std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+  return host;
+}
+
+struct LocalAddress {
+  std::string iface;       // CURLOPT_INTERFACE value; empty for prefixes
+  int family{0};           // 4, 6 or 0 for interface names
+  unsigned char prefix[16] = {0};
+  int prefixLen{-1};       // >= 0 for IPv6 prefixes like "2001:db8::/64"
+  uint32_t inflight{0};
+};
+
+// Spreads requests over source addresses. Each host hashes to a home
+// address so its connections stay put, and only spills to the least
+// loaded address once the home one carries `spillAt` requests. Nothing
+// waits: with every address that busy, the home one takes more anyway.
+class LocalAddressPool {
+public:
+  bool empty() const { return entries.empty(); }
+
+  void add(const std::string& spec) {
+    LocalAddress a;
+    std::string addr = spec;
+    if (addr.rfind("if!", 0) == 0 || addr.rfind("host!", 0) == 0 || addr.rfind("ifhost!", 0) == 0) {
+      a.iface = addr;
+      entries.push_back(a);
+      return;
+    }
+    size_t slash = addr.find('/');
+    if (slash != std::string::npos) {
+      std::string base = addr.substr(0, slash);
+      int len = std::atoi(addr.c_str() + slash + 1);
+      if (inet_pton(AF_INET6, base.c_str(), a.prefix) == 1 && len >= 0 && len <= 128) {
+        a.family = 6;
+        a.prefixLen = len;
+        entries.push_back(a);
+      }
+      return;
+    }
+    unsigned char buf[16];
+    if (inet_pton(AF_INET, addr.c_str(), buf) == 1) a.family = 4;
+    else if (inet_pton(AF_INET6, addr.c_str(), buf) == 1) a.family = 6;
+    // "host!" binds to the address itself instead of looking up an interface.
+    a.iface = a.family ? "host!" + addr : addr;
+    entries.push_back(a);
+  }
+
+  int acquire(const std::string& host, std::string& iface, int& family) {
+    std::lock_guard<std::mutex> lock(mu);
+    size_t n = entries.size();
+    size_t pick = sticky ? std::hash<std::string>{}(host) % n : cursor++ % n;
+    if (spillAt > 0 && entries[pick].inflight >= spillAt) {
+      for (size_t i = 0; i < n; ++i) {
+        if (entries[i].inflight < entries[pick].inflight) pick = i;
+      }
+    }
+    LocalAddress& a = entries[pick];
+    a.inflight++;
+    family = a.family;
+    iface = a.prefixLen >= 0 ? "host!" + addressInPrefix(a, host) : a.iface;
+    return (int)pick;
+  }
+
+  void release(int idx) {
+    std::lock_guard<std::mutex> lock(mu);
+    if (entries[idx].inflight > 0) entries[idx].inflight--;
+  }
+
+  bool sticky{true};
+  uint32_t spillAt{0};
+
+private:
+  // Fills the host bits of the prefix from the host name, giving every host
+  // its own stable source address inside a routed IPv6 block.
+  static std::string addressInPrefix(const LocalAddress& a, const std::string& host) {
+    unsigned char out[16];
+    uint64_t h1 = std::hash<std::string>{}(host);
+    uint64_t h2 = std::hash<std::string>{}(host + "#");
+    for (int i = 0; i < 16; ++i) {
+      unsigned char r = (unsigned char)((i < 8 ? h2 : h1) >> ((i % 8) * 8));
+      int bits = a.prefixLen - i * 8;
+      unsigned char mask = bits >= 8 ? 0xff : bits <= 0 ? 0 : (unsigned char)(0xff << (8 - bits));
+      out[i] = (a.prefix[i] & mask) | (r & ~mask);
+    }
+    char text[64];
+    inet_ntop(AF_INET6, out, text, sizeof(text));
+    return text;
+  }
+
+  std::vector<LocalAddress> entries;
+  size_t cursor{0};
+  std::mutex mu;
+};
+
+// Socket options; -1 / 0 leave the system or curl default untouched.
+struct SocketTuning {
+  int noDelay{-1};
+  int fastOpen{-1};
+  int keepAlive{-1};
+  long keepIdle{0};      // seconds
+  long keepInterval{0};  // seconds
+  long keepCount{0};
+  int rcvBuf{0};
+  int sndBuf{0};
+  int quickAck{-1};
+  int notSentLowat{0};
+  bool needsCallback() const { return rcvBuf > 0 || sndBuf > 0 || quickAck >= 0 || notSentLowat > 0; }
+};
+
+// Overlays the keys present in `o` onto `t`, so per-request blocks only
+// override what they mention.
+static void parseSocketTuning(Napi::Object o, SocketTuning& t) {
+  auto flag = [&](const char* k, int& dst) {
+    if (o.Has(k) && o.Get(k).IsBoolean()) dst = o.Get(k).As<Napi::Boolean>().Value() ? 1 : 0;
+  };
+  auto num = [&](const char* k, auto& dst) {
+    if (o.Has(k) && o.Get(k).IsNumber()) dst = o.Get(k).As<Napi::Number>().Int32Value();
+  };
+  flag("noDelay", t.noDelay);
+  flag("fastOpen", t.fastOpen);
+  flag("keepAlive", t.keepAlive);
+  num("keepIdle", t.keepIdle);
+  num("keepInterval", t.keepInterval);
+  num("keepCount", t.keepCount);
+  num("rcvBuf", t.rcvBuf);
+  num("sndBuf", t.sndBuf);
+  flag("quickAck", t.quickAck);
+  num("notSentLowat", t.notSentLowat);
+}
+
+static int sockopt_cb(void* clientp, curl_socket_t fd, curlsocktype purpose) {
+  if (purpose != CURLSOCKTYPE_IPCXN) return CURL_SOCKOPT_OK;
+  const SocketTuning* t = reinterpret_cast<const SocketTuning*>(clientp);
+  // Failures are ignored: a tuning knob the kernel lacks must not fail the request.
+  if (t->rcvBuf > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char*)&t->rcvBuf, sizeof(t->rcvBuf));
+  if (t->sndBuf > 0) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char*)&t->sndBuf, sizeof(t->sndBuf));
+#ifdef TCP_QUICKACK
+  if (t->quickAck >= 0) setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, (const char*)&t->quickAck, sizeof(t->quickAck));
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+  if (t->notSentLowat > 0) setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char*)&t->notSentLowat, sizeof(t->notSentLowat));
+#endif
+  return CURL_SOCKOPT_OK;
+}
+
+static void applySocketTuning(CURL* curl, SocketTuning* t) {
+  if (t->noDelay >= 0) curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, (long)t->noDelay);
+  if (t->fastOpen >= 0) curl_easy_setopt(curl, CURLOPT_TCP_FASTOPEN, (long)t->fastOpen);
+  if (t->keepAlive >= 0) curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, (long)t->keepAlive);
+  if (t->keepIdle > 0) curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, t->keepIdle);
+  if (t->keepInterval > 0) curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, t->keepInterval);
+  if (t->keepCount > 0) curl_easy_setopt(curl, CURLOPT_TCP_KEEPCNT, t->keepCount);
+  if (t->needsCallback()) {
+    curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, sockopt_cb);
+    curl_easy_setopt(curl, CURLOPT_SOCKOPTDATA, t);
+  }
+}
+
+// Per-phase budgets in ms, each measured from the end of the previous
+// phase; 0 disables the check. `idle` is the longest allowed gap between
+// body chunks once the response has started.
+struct PhaseDeadlines {
+  uint32_t dns{0};
+  uint32_t connect{0};
+  uint32_t tls{0};
+  uint32_t firstByte{0};
+  uint32_t idle{0};
+  bool any() const { return dns || connect || tls || firstByte || idle; }
 };
 
-struct StreamCtx {
-  Napi::Env env;
-  Napi::FunctionReference enqueue;
-};
+static void parsePhaseDeadlines(Napi::Object o, PhaseDeadlines& d, uint32_t& total) {
+  auto num = [&](const char* k, uint32_t& dst) {
+    if (o.Has(k) && o.Get(k).IsNumber()) dst = o.Get(k).As<Napi::Number>().Uint32Value();
+  };
+  num("dns", d.dns);
+  num("connect", d.connect);
+  num("tls", d.tls);
+  num("firstByte", d.firstByte);
+  num("idle", d.idle);
+  num("total", total);
+}
+
+struct DeadlineWatch {
+  CURL* curl{nullptr};
+  PhaseDeadlines limits;
+  int64_t start{0};
+  int64_t lastProgress{0};
+  curl_off_t lastBytes{-1};
+  const char* expired{nullptr};
+  uint32_t expiredLimit{0};
+  // Phase probes, when a tracer listens.
+  bool probes{false};
+  unsigned probed{0};
+  uint64_t requestId{0};
+  const char* host{""};
+};
+
+static bool phaseProbesEnabled() {
+  return CURLNAPI_PROBE_ENABLED(dns__done) || CURLNAPI_PROBE_ENABLED(connect__done) || CURLNAPI_PROBE_ENABLED(tls__done) || CURLNAPI_PROBE_ENABLED(first__byte);
+}
+
+// Fires each phase probe once, as soon as curl's timer for it is set.
+static void firePhaseProbes(DeadlineWatch* w, curl_off_t dns, curl_off_t conn, curl_off_t first) {
+  curl_off_t tls = 0;
+  if (dns > 0 && !(w->probed & 1)) { w->probed |= 1; CURLNAPI_PROBE3(dns__done, w->requestId, w->host, dns); }
+  if (conn > 0 && !(w->probed & 2)) { w->probed |= 2; CURLNAPI_PROBE3(connect__done, w->requestId, w->host, conn); }
+  if (!(w->probed & 4) && curl_easy_getinfo(w->curl, CURLINFO_APPCONNECT_TIME_T, &tls) == CURLE_OK && tls > 0) {
+    w->probed |= 4;
+    CURLNAPI_PROBE3(tls__done, w->requestId, w->host, tls);
+  }
+  if (first > 0 && !(w->probed & 8)) { w->probed |= 8; CURLNAPI_PROBE3(first__byte, w->requestId, w->host, first); }
+}
+
+// Works out the current phase from curl's timers (0 until reached) and
+// aborts the transfer once that phase has overrun its budget.
+static int deadline_cb(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+  DeadlineWatch* w = reinterpret_cast<DeadlineWatch*>(clientp);
+  const PhaseDeadlines& l = w->limits;
+  int64_t now = nowMs();
+  double elapsed = (double)(now - w->start);
+  curl_off_t dns = 0, conn = 0, pre = 0, first = 0;
+  curl_easy_getinfo(w->curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(w->curl, CURLINFO_CONNECT_TIME_T, &conn);
+  curl_easy_getinfo(w->curl, CURLINFO_PRETRANSFER_TIME_T, &pre);
+  curl_easy_getinfo(w->curl, CURLINFO_STARTTRANSFER_TIME_T, &first);
+  if (w->probes) firePhaseProbes(w, dns, conn, first);
+  auto check = [&](const char* phase, uint32_t limit, double since) {
+    if (limit && elapsed - since / 1000.0 > limit) { w->expired = phase; w->expiredLimit = limit; }
+  };
+  if (pre == 0) {
+    if (dns == 0) check("dns", l.dns, 0);
+    else if (conn == 0) check("connect", l.connect, (double)dns);
+    else check("tls", l.tls, (double)conn);
+  } else if (first == 0) {
+    check("firstByte", l.firstByte, (double)pre);
+  } else if (l.idle) {
+    curl_off_t bytes = dlnow + ulnow;
+    if (bytes != w->lastBytes) {
+      w->lastBytes = bytes;
+      w->lastProgress = now;
+    } else if (now - w->lastProgress > l.idle) {
+      w->expired = "idle";
+      w->expiredLimit = l.idle;
+    }
+  }
+  return w->expired ? 1 : 0;
+}
+
+// Names the deadline behind a CURLE_OPERATION_TIMEDOUT from curl's own
+// error text, since every curl-side timeout shares that one code.
+static const char* curlTimeoutPhase(const char* errbuf) {
+  std::string e(errbuf);
+  if (e.rfind("Resolving timed out", 0) == 0) return "dns";
+  if (e.rfind("Connection timed out", 0) == 0 || e.rfind("Failed to connect", 0) == 0) return "connect";
+  if (e.rfind("SSL connection timeout", 0) == 0) return "tls";
+  if (e.rfind("Operation too slow", 0) == 0) return "lowSpeed";
+  return "total";
+}
+
+static Napi::Error abortError(Napi::Env env) {
+  Napi::Error err = Napi::Error::New(env, "The operation was aborted");
+  err.Value().Set("name", Napi::String::New(env, "AbortError"));
+  return err;
+}
+
+static Napi::Error circuitOpenError(Napi::Env env, const std::string& key, int64_t retryInMs) {
+  Napi::Error err = Napi::Error::New(env, "Circuit open for " + key);
+  err.Value().Set("name", Napi::String::New(env, "CircuitOpenError"));
+  err.Value().Set("code", Napi::String::New(env, "ECIRCUITOPEN"));
+  err.Value().Set("key", Napi::String::New(env, key));
+  err.Value().Set("retryInMs", Napi::Number::New(env, (double)retryInMs));
+  return err;
+}
+
+static Napi::Error groupError(Napi::Env env, const char* reason) {
+  Napi::Error err = Napi::Error::New(env, std::string("Request group ended: ") + reason);
+  err.Value().Set("name", Napi::String::New(env, "AbortError"));
+  err.Value().Set("reason", Napi::String::New(env, reason));
+  return err;
+}
+
+static std::string transferMessage(CURLcode rc, const char* errbuf, const DeadlineWatch& watch, const char*& phase) {
+  phase = nullptr;
+  std::string msg = curl_easy_strerror(rc);
+  if (rc == CURLE_ABORTED_BY_CALLBACK && watch.expired) {
+    phase = watch.expired;
+    msg = std::string(curl_easy_strerror(CURLE_OPERATION_TIMEDOUT)) + " (" + phase + " deadline of " + std::to_string(watch.expiredLimit) + " ms)";
+  } else if (rc == CURLE_OPERATION_TIMEDOUT) {
+    phase = curlTimeoutPhase(errbuf);
+    msg += std::string(" (") + phase + " phase)";
+  }
+  return msg;
+}
+
+static Napi::Error transferError(Napi::Env env, CURLcode rc, const char* errbuf, const DeadlineWatch& watch) {
+  const char* phase;
+  Napi::Error err = Napi::Error::New(env, transferMessage(rc, errbuf, watch, phase));
+  err.Value().Set("curlCode", Napi::Number::New(env, rc));
+  if (phase) err.Value().Set("phase", Napi::String::New(env, phase));
+  return err;
+}
+
+// Snapshot of curl's per-transfer info, taken before the handle goes away.
+struct TransferTimings {
+  curl_off_t namelookup{0}, connect{0}, appconnect{0}, pretransfer{0}, starttransfer{0}, redirect{0}, total{0};
+  curl_off_t bytesUp{0}, bytesDown{0};
+  long headerBytes{0}, requestBytes{0};
+  long numConnects{0};
+  long httpVersion{0};
+  std::string remoteIp, localIp;
+  long remotePort{0}, localPort{0};
+};
+
+static void collectTimings(CURL* curl, TransferTimings& t) {
+  curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &t.namelookup);
+  curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &t.connect);
+  curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &t.appconnect);
+  curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &t.pretransfer);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &t.starttransfer);
+  curl_easy_getinfo(curl, CURLINFO_REDIRECT_TIME_T, &t.redirect);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &t.total);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &t.bytesUp);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &t.bytesDown);
+  curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &t.headerBytes);
+  curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &t.requestBytes);
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &t.numConnects);
+  curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &t.httpVersion);
+  char* ip = nullptr;
+  if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip) == CURLE_OK && ip) t.remoteIp = ip;
+  ip = nullptr;
+  if (curl_easy_getinfo(curl, CURLINFO_LOCAL_IP, &ip) == CURLE_OK && ip) t.localIp = ip;
+  curl_easy_getinfo(curl, CURLINFO_PRIMARY_PORT, &t.remotePort);
+  curl_easy_getinfo(curl, CURLINFO_LOCAL_PORT, &t.localPort);
+}
+
+// Only meaningful once a connection was ready; a request that failed in DNS
+// or connect made none, new or reused.
+static bool connectionReused(const TransferTimings& t) {
+  return t.pretransfer > 0 && t.numConnects == 0;
+}
+
+static const char* httpVersionName(long v) {
+  switch (v) {
+    case CURL_HTTP_VERSION_1_0: return "1.0";
+    case CURL_HTTP_VERSION_1_1: return "1.1";
+    case CURL_HTTP_VERSION_2_0: return "2";
+    case CURL_HTTP_VERSION_3: return "3";
+    default: return "";
+  }
+}
+
+// Phase times are cumulative ms since the request started, as curl reports them.
+static Napi::Object timingsToObject(Napi::Env env, const TransferTimings& t) {
+  Napi::Object o = Napi::Object::New(env);
+  o.Set("dns", Napi::Number::New(env, t.namelookup / 1000.0));
+  o.Set("connect", Napi::Number::New(env, t.connect / 1000.0));
+  o.Set("tls", Napi::Number::New(env, t.appconnect / 1000.0));
+  o.Set("pretransfer", Napi::Number::New(env, t.pretransfer / 1000.0));
+  o.Set("firstByte", Napi::Number::New(env, t.starttransfer / 1000.0));
+  o.Set("redirect", Napi::Number::New(env, t.redirect / 1000.0));
+  o.Set("total", Napi::Number::New(env, t.total / 1000.0));
+  o.Set("bytesUp", Napi::Number::New(env, (double)(t.bytesUp + t.requestBytes)));
+  o.Set("bytesDown", Napi::Number::New(env, (double)(t.bytesDown + t.headerBytes)));
+  o.Set("numConnects", Napi::Number::New(env, t.numConnects));
+  o.Set("reused", Napi::Boolean::New(env, connectionReused(t)));
+  o.Set("httpVersion", Napi::String::New(env, httpVersionName(t.httpVersion)));
+  o.Set("remoteIp", Napi::String::New(env, t.remoteIp));
+  o.Set("remotePort", Napi::Number::New(env, t.remotePort));
+  o.Set("localIp", Napi::String::New(env, t.localIp));
+  o.Set("localPort", Napi::Number::New(env, t.localPort));
+  return o;
+}
+
+// "scheme://host:port" of an absolute URL, with the default port filled in.
+static std::string urlOrigin(const std::string& url) {
+  size_t p = url.find("://");
+  std::string scheme = p == std::string::npos ? "http" : url.substr(0, p);
+  std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+  size_t s = (p == std::string::npos) ? 0 : p + 3;
+  size_t e = url.find_first_of("/?#", s);
+  std::string authority = url.substr(s, e == std::string::npos ? std::string::npos : e - s);
+  size_t at = authority.rfind('@');
+  if (at != std::string::npos) authority = authority.substr(at + 1);
+  size_t rb = authority.rfind(']');
+  size_t colon = authority.rfind(':');
+  std::string port;
+  if (colon != std::string::npos && (rb == std::string::npos || colon > rb)) port = authority.substr(colon + 1);
+  else port = scheme == "https" ? "443" : "80";
+  std::string host = urlHost(url);
+  if (host.find(':') != std::string::npos) host = "[" + host + "]";
+  return scheme + "://" + host + ":" + port;
+}
+
+// Log-linear latency histogram in microseconds: 8 sub-buckets per power of
+// two (about 12% resolution) up to ~4.7 hours. Recording is a couple of
+// relaxed atomic adds, so completions never contend on a lock.
+class Histogram {
+public:
+  static constexpr int kSub = 8;
+  static constexpr int kBuckets = kSub * 32;
+
+  void record(uint64_t us) {
+    buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sumUs.fetch_add(us, std::memory_order_relaxed);
+    uint64_t prev = maxUs.load(std::memory_order_relaxed);
+    while (us > prev && !maxUs.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {}
+  }
+
+  uint64_t count() const { return total.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sumUs.load(std::memory_order_relaxed); }
+  uint64_t max() const { return maxUs.load(std::memory_order_relaxed); }
+
+  // Upper bound of the bucket holding the q-quantile.
+  uint64_t percentile(double q) const {
+    uint64_t n = count();
+    if (n == 0) return 0;
+    uint64_t rank = (uint64_t)(q * n);
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      seen += buckets[i].load(std::memory_order_relaxed);
+      if (seen > rank) return std::min(upperBound(i), max());
+    }
+    return max();
+  }
+
+  // Samples known to be <= us, for cumulative Prometheus buckets.
+  uint64_t countAtMost(uint64_t us) const {
+    uint64_t c = 0;
+    for (int i = 0; i < kBuckets && upperBound(i) <= us + 1; ++i) c += buckets[i].load(std::memory_order_relaxed);
+    return c;
+  }
+
+private:
+  static int bucketOf(uint64_t v) {
+    if (v < (uint64_t)kSub) return (int)v;
+    int msb = 0;
+    for (uint64_t x = v; x > 1; x >>= 1) msb++;
+    int idx = (msb - 2) * kSub + (int)((v >> (msb - 3)) & (kSub - 1));
+    return std::min(idx, kBuckets - 1);
+  }
+  // Exclusive upper bound of bucket i.
+  static uint64_t upperBound(int i) {
+    int octave = i / kSub, sub = i % kSub;
+    if (octave == 0) return (uint64_t)sub + 1;
+    return (uint64_t)(kSub + sub + 1) << (octave - 1);
+  }
+
+  std::atomic<uint64_t> buckets[kBuckets]{};
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> sumUs{0};
+  std::atomic<uint64_t> maxUs{0};
+};
+
+// count/mean/p50/p90/p99/max of a microsecond histogram, in ms.
+static Napi::Object summarizeMs(Napi::Env env, const Histogram& h) {
+  Napi::Object o = Napi::Object::New(env);
+  uint64_t n = h.count();
+  o.Set("count", Napi::Number::New(env, (double)n));
+  o.Set("mean", Napi::Number::New(env, n ? h.sum() / 1000.0 / n : 0));
+  o.Set("p50", Napi::Number::New(env, h.percentile(0.5) / 1000.0));
+  o.Set("p90", Napi::Number::New(env, h.percentile(0.9) / 1000.0));
+  o.Set("p99", Napi::Number::New(env, h.percentile(0.99) / 1000.0));
+  o.Set("max", Napi::Number::New(env, h.max() / 1000.0));
+  return o;
+}
+
+enum MetricPhase { kPhaseDns, kPhaseConnect, kPhaseTls, kPhaseFirstByte, kPhaseTotal, kPhaseCount };
+static const char* const kPhaseNames[kPhaseCount] = { "dns", "connect", "tls", "firstByte", "total" };
+
+struct EndpointMetrics {
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> retries{0};
+  std::atomic<uint64_t> bytesUp{0};
+  std::atomic<uint64_t> bytesDown{0};
+  std::atomic<uint64_t> newConnections{0};
+  std::atomic<uint64_t> reusedConnections{0};
+  std::atomic<uint64_t> statusClass[6]{};  // [1] = 1xx ... [5] = 5xx
+  std::atomic<uint64_t> errors[CURL_LAST]{};
+  Histogram phases[kPhaseCount];
+};
+
+// Aggregates completed transfers per origin and per proxy. The maps are
+// only write-locked the first time a key shows up; everything after that
+// is atomic adds under a shared lock.
+class MetricsRegistry {
+public:
+  void record(const std::string& origin, const std::string& proxy, const TransferTimings& t, CURLcode rc, long status, uint32_t retries) {
+    recordInto(endpoint(origins, origin), t, rc, status, retries);
+    if (!proxy.empty()) recordInto(endpoint(proxies, redactProxy(proxy)), t, rc, status, retries);
+  }
+
+  Napi::Object snapshot(Napi::Env env) {
+    std::shared_lock<std::shared_mutex> lock(mu);
+    Napi::Object o = Napi::Object::New(env);
+    o.Set("origins", snapshotMap(env, origins));
+    o.Set("proxies", snapshotMap(env, proxies));
+    return o;
+  }
+
+  std::string prometheus() {
+    std::shared_lock<std::shared_mutex> lock(mu);
+    std::string out;
+    auto family = [&](const char* name, const char* type, const char* help) {
+      out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+    };
+    auto each = [&](auto fn) {
+      for (auto& kv : origins) fn("origin=\"" + escapeLabel(kv.first) + "\"", *kv.second);
+      for (auto& kv : proxies) fn("proxy=\"" + escapeLabel(kv.first) + "\"", *kv.second);
+    };
+    family("curlnapi_requests_total", "counter", "Completed requests.");
+    each([&](const std::string& l, EndpointMetrics& m) { line(out, "curlnapi_requests_total", l, m.requests); });
+    family("curlnapi_responses_total", "counter", "Responses by status class.");
+    each([&](const std::string& l, EndpointMetrics& m) {
+      for (int c = 1; c <= 5; ++c) {
+        if (m.statusClass[c].load()) line(out, "curlnapi_responses_total", l + ",class=\"" + std::to_string(c) + "xx\"", m.statusClass[c]);
+      }
+    });
+    family("curlnapi_errors_total", "counter", "Transfer failures by curl error code.");
+    each([&](const std::string& l, EndpointMetrics& m) {
+      for (int c = 1; c < CURL_LAST; ++c) {
+        if (m.errors[c].load()) line(out, "curlnapi_errors_total", l + ",code=\"" + std::to_string(c) + "\"", m.errors[c]);
+      }
+    });
+    family("curlnapi_bytes_total", "counter", "Bytes transferred, headers included.");
+    each([&](const std::string& l, EndpointMetrics& m) {
+      line(out, "curlnapi_bytes_total", l + ",direction=\"up\"", m.bytesUp);
+      line(out, "curlnapi_bytes_total", l + ",direction=\"down\"", m.bytesDown);
+    });
+    family("curlnapi_retries_total", "counter", "Proxy failover retries.");
+    each([&](const std::string& l, EndpointMetrics& m) { line(out, "curlnapi_retries_total", l, m.retries); });
+    family("curlnapi_connections_total", "counter", "Transfers by connection reuse.");
+    each([&](const std::string& l, EndpointMetrics& m) {
+      line(out, "curlnapi_connections_total", l + ",reused=\"false\"", m.newConnections);
+      line(out, "curlnapi_connections_total", l + ",reused=\"true\"", m.reusedConnections);
+    });
+    static const double kBounds[] = { 0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30 };
+    family("curlnapi_phase_seconds", "histogram", "Duration of each request phase.");
+    each([&](const std::string& l, EndpointMetrics& m) {
+      for (int p = 0; p < kPhaseCount; ++p) {
+        const Histogram& h = m.phases[p];
+        if (!h.count()) continue;
+        std::string pl = l + ",phase=\"" + kPhaseNames[p] + "\"";
+        for (double b : kBounds) {
+          out += "curlnapi_phase_seconds_bucket{" + pl + ",le=\"" + formatNumber(b) + "\"} " + std::to_string(h.countAtMost((uint64_t)(b * 1e6))) + "\n";
+        }
+        out += "curlnapi_phase_seconds_bucket{" + pl + ",le=\"+Inf\"} " + std::to_string(h.count()) + "\n";
+        out += "curlnapi_phase_seconds_sum{" + pl + "} " + formatNumber(h.sum() / 1e6) + "\n";
+        out += "curlnapi_phase_seconds_count{" + pl + "} " + std::to_string(h.count()) + "\n";
+      }
+    });
+    return out;
+  }
+
+  size_t maxKeys{1000};
+
+private:
+  using Map = std::map<std::string, std::unique_ptr<EndpointMetrics>>;
+
+  // Keys beyond maxKeys share one "other" bucket so a wide crawl cannot
+  // grow the registry without bound.
+  EndpointMetrics& endpoint(Map& m, const std::string& key) {
+    {
+      std::shared_lock<std::shared_mutex> lock(mu);
+      auto it = m.find(key);
+      if (it != m.end()) return *it->second;
+    }
+    std::unique_lock<std::shared_mutex> lock(mu);
+    const std::string& k = m.size() >= maxKeys && !m.count(key) ? kOther : key;
+    auto& slot = m[k];
+    if (!slot) slot.reset(new EndpointMetrics());
+    return *slot;
+  }
+
+  static void recordInto(EndpointMetrics& m, const TransferTimings& t, CURLcode rc, long status, uint32_t retries) {
+    m.requests.fetch_add(1, std::memory_order_relaxed);
+    if (retries) m.retries.fetch_add(retries, std::memory_order_relaxed);
+    m.bytesUp.fetch_add((uint64_t)(t.bytesUp + t.requestBytes), std::memory_order_relaxed);
+    m.bytesDown.fetch_add((uint64_t)(t.bytesDown + t.headerBytes), std::memory_order_relaxed);
+    if (rc != CURLE_OK) {
+      if (rc > 0 && rc < CURL_LAST) m.errors[rc].fetch_add(1, std::memory_order_relaxed);
+    } else if (status >= 100 && status < 600) {
+      m.statusClass[status / 100].fetch_add(1, std::memory_order_relaxed);
+    }
+    if (t.pretransfer == 0) return;
+    if (t.numConnects > 0) {
+      m.newConnections.fetch_add(1, std::memory_order_relaxed);
+      m.phases[kPhaseDns].record((uint64_t)t.namelookup);
+      m.phases[kPhaseConnect].record((uint64_t)std::max<curl_off_t>(0, t.connect - t.namelookup));
+      if (t.appconnect > 0) m.phases[kPhaseTls].record((uint64_t)std::max<curl_off_t>(0, t.appconnect - t.connect));
+    } else {
+      m.reusedConnections.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (t.starttransfer > 0) m.phases[kPhaseFirstByte].record((uint64_t)std::max<curl_off_t>(0, t.starttransfer - t.pretransfer));
+    m.phases[kPhaseTotal].record((uint64_t)t.total);
+  }
+
+  static Napi::Object snapshotMap(Napi::Env env, const Map& m) {
+    Napi::Object out = Napi::Object::New(env);
+    for (auto& kv : m) {
+      const EndpointMetrics& e = *kv.second;
+      Napi::Object o = Napi::Object::New(env);
+      o.Set("requests", Napi::Number::New(env, (double)e.requests.load()));
+      o.Set("retries", Napi::Number::New(env, (double)e.retries.load()));
+      o.Set("bytesUp", Napi::Number::New(env, (double)e.bytesUp.load()));
+      o.Set("bytesDown", Napi::Number::New(env, (double)e.bytesDown.load()));
+      double fresh = (double)e.newConnections.load(), reused = (double)e.reusedConnections.load();
+      o.Set("reuseRatio", Napi::Number::New(env, fresh + reused > 0 ? reused / (fresh + reused) : 0));
+      Napi::Object st = Napi::Object::New(env);
+      for (int c = 1; c <= 5; ++c) st.Set(std::to_string(c) + "xx", Napi::Number::New(env, (double)e.statusClass[c].load()));
+      o.Set("status", st);
+      Napi::Object er = Napi::Object::New(env);
+      for (int c = 1; c < CURL_LAST; ++c) {
+        if (e.errors[c].load()) er.Set(std::to_string(c), Napi::Number::New(env, (double)e.errors[c].load()));
+      }
+      o.Set("errors", er);
+      Napi::Object ph = Napi::Object::New(env);
+      for (int p = 0; p < kPhaseCount; ++p) ph.Set(kPhaseNames[p], summarizeMs(env, e.phases[p]));
+      o.Set("phases", ph);
+      out.Set(kv.first, o);
+    }
+    return out;
+  }
+
+  static void line(std::string& out, const char* name, const std::string& labels, const std::atomic<uint64_t>& v) {
+    out += std::string(name) + "{" + labels + "} " + std::to_string(v.load(std::memory_order_relaxed)) + "\n";
+  }
+
+  static std::string escapeLabel(const std::string& v) {
+    std::string out;
+    for (char c : v) {
+      if (c == '\\' || c == '"') { out.push_back('\\'); out.push_back(c); }
+      else if (c == '\n') out += "\\n";
+      else out.push_back(c);
+    }
+    return out;
+  }
+
+  static std::string formatNumber(double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%g", v);
+    return buf;
+  }
+
+  const std::string kOther{"other"};
+  Map origins;
+  Map proxies;
+  std::shared_mutex mu;
+};
+
+enum TraceType : uint8_t { kTraceRequest, kTraceInfo, kTraceConnect, kTraceReuse, kTraceTls, kTraceHeaderOut, kTraceHeaderIn, kTraceResponse, kTraceError, kTraceTypeCount };
+static const char* const kTraceTypeNames[kTraceTypeCount] = { "request", "info", "connect", "reuse", "tls", "headerOut", "headerIn", "response", "error" };
+
+// Fixed-size flight recorder. Writers claim a slot with one fetch_add and
+// publish it through a per-slot sequence (seqlock), so tracing never blocks
+// a transfer; readers skip slots that are being rewritten underneath them.
+class TraceRing {
+public:
+  explicit TraceRing(size_t capacity) {
+    size_t cap = 64;
+    while (cap < capacity) cap <<= 1;
+    slots.reset(new Slot[cap]);
+    mask = cap - 1;
+  }
+
+  void push(uint64_t requestId, TraceType type, const char* data, size_t len) {
+    uint64_t pos = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& s = slots[pos & mask];
+    s.seq.store(2 * pos + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.requestId = requestId;
+    s.time = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count() / 1000.0;
+    s.type = type;
+    s.len = (uint16_t)std::min(len, sizeof(s.text));
+    memcpy(s.text, data, s.len);
+    s.seq.store(2 * pos + 2, std::memory_order_release);
+  }
+
+  void push(uint64_t requestId, TraceType type, const std::string& text) {
+    push(requestId, type, text.data(), text.size());
+  }
+
+  // Events written since the previous drain, oldest first.
+  Napi::Array drain(Napi::Env env) {
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t start = std::max(tail, end > mask + 1 ? end - (mask + 1) : 0);
+    Napi::Array out = read(env, start, end, 0);
+    tail = end;
+    return out;
+  }
+
+  // Everything still in the buffer without consuming it, optionally for a
+  // single request.
+  Napi::Array dump(Napi::Env env, uint64_t requestId) {
+    uint64_t end = head.load(std::memory_order_acquire);
+    return read(env, end > mask + 1 ? end - (mask + 1) : 0, end, requestId);
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    uint64_t requestId{0};
+    double time{0};
+    TraceType type{kTraceInfo};
+    uint16_t len{0};
+    char text[230];
+  };
+
+  Napi::Array read(Napi::Env env, uint64_t start, uint64_t end, uint64_t requestId) {
+    Napi::Array out = Napi::Array::New(env);
+    uint32_t n = 0;
+    Slot copy;
+    for (uint64_t pos = start; pos < end; ++pos) {
+      Slot& s = slots[pos & mask];
+      uint64_t seq = s.seq.load(std::memory_order_acquire);
+      if (seq != 2 * pos + 2) continue;
+      copy.requestId = s.requestId;
+      copy.time = s.time;
+      copy.type = s.type;
+      copy.len = s.len;
+      memcpy(copy.text, s.text, std::min<size_t>(copy.len, sizeof(copy.text)));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (s.seq.load(std::memory_order_relaxed) != seq) continue;
+      if (requestId && copy.requestId != requestId) continue;
+      Napi::Object e = Napi::Object::New(env);
+      e.Set("seq", Napi::Number::New(env, (double)pos));
+      e.Set("time", Napi::Number::New(env, copy.time));
+      e.Set("requestId", Napi::Number::New(env, (double)copy.requestId));
+      e.Set("type", Napi::String::New(env, kTraceTypeNames[copy.type < kTraceTypeCount ? copy.type : kTraceInfo]));
+      e.Set("text", Napi::String::New(env, copy.text, copy.len));
+      out.Set(n++, e);
+    }
+    return out;
+  }
+
+  std::unique_ptr<Slot[]> slots;
+  uint64_t mask{0};
+  std::atomic<uint64_t> head{0};
+  uint64_t tail{0};
+};
+
+struct TraceCtx {
+  TraceRing* ring;
+  uint64_t requestId;
+};
+
+static TraceType classifyInfo(const char* data, size_t len) {
+  std::string t(data, std::min<size_t>(len, 32));
+  if (t.rfind("Re-using", 0) == 0 || t.rfind("Reusing", 0) == 0) return kTraceReuse;
+  if (t.rfind("Connected to", 0) == 0 || t.rfind("Trying", 0) == 0 || t.rfind("Established connection", 0) == 0) return kTraceConnect;
+  if (t.rfind("SSL", 0) == 0 || t.rfind("TLS", 0) == 0 || t.rfind("ALPN", 0) == 0 || t.rfind("Server certificate", 0) == 0 || t.rfind(" subject:", 0) == 0 || t.rfind(" issuer:", 0) == 0) return kTraceTls;
+  return kTraceInfo;
+}
+
+// Splits curl's debug stream into one event per line. Body data and raw
+// TLS records are not recorded.
+static int debug_cb(CURL* handle, curl_infotype type, char* data, size_t size, void* clientp) {
+  TraceCtx* ctx = reinterpret_cast<TraceCtx*>(clientp);
+  TraceType tt;
+  switch (type) {
+    case CURLINFO_TEXT: tt = classifyInfo(data, size); break;
+    case CURLINFO_HEADER_OUT: tt = kTraceHeaderOut; break;
+    case CURLINFO_HEADER_IN: tt = kTraceHeaderIn; break;
+    default: return 0;
+  }
+  size_t start = 0;
+  while (start < size) {
+    size_t end = start;
+    while (end < size && data[end] != '\n') end++;
+    size_t len = end - start;
+    if (len > 0 && data[start + len - 1] == '\r') len--;
+    if (len > 0) ctx->ring->push(ctx->requestId, tt, data + start, len);
+    start = end + 1;
+  }
+  return 0;
+}
+
+struct Transfer;
+
+// Requests that live and die together: a shared concurrency cap, byte
+// budget and deadline. Once it ends, every member is torn down at once.
+struct RequestGroup {
+  bool end(const char* why) {
+    const char* expected = nullptr;
+    return reason.compare_exchange_strong(expected, why);
+  }
+  bool ended() const { return reason.load() != nullptr; }
+
+  uint64_t id{0};
+  uint32_t maxConcurrency{0};
+  uint64_t maxBytes{0};
+  int64_t deadline{0};
+  std::atomic<const char*> reason{nullptr};
+  std::atomic<uint32_t> active{0};
+  std::atomic<uint32_t> queued{0};
+  std::atomic<uint64_t> completed{0};
+  std::atomic<uint64_t> failed{0};
+  std::atomic<uint64_t> bytes{0};
+  Histogram latency;
+  // Engine thread only.
+  std::deque<Transfer*> pending;
+  bool tornDown{false};
+};
+
+struct TokenBucket {
+  void configure(double perSecond, double capacity) {
+    rate = perSecond;
+    burst = capacity > 0 ? capacity : std::max(1.0, perSecond);
+    tokens = burst;
+  }
+  bool limited() const { return rate > 0; }
+  void refill(int64_t now) {
+    if (rate > 0 && now > last) tokens = std::min(burst, tokens + (now - last) * rate / 1000.0);
+    last = now;
+  }
+  // ms until the bucket holds at least `need` tokens.
+  int64_t wait(double need) const {
+    return tokens >= need ? 0 : (int64_t)((need - tokens) * 1000.0 / rate) + 1;
+  }
+
+  double rate{0};
+  double burst{0};
+  double tokens{0};
+  int64_t last{0};
+};
+
+struct OriginLimits {
+  uint32_t maxConcurrency{0};
+  double requestsPerSecond{0};
+  double bytesPerSecond{0};
+  double burst{0};
+};
+
+static void parseOriginLimits(Napi::Object o, OriginLimits& l) {
+  if (o.Has("maxPerOrigin") && o.Get("maxPerOrigin").IsNumber()) l.maxConcurrency = o.Get("maxPerOrigin").As<Napi::Number>().Uint32Value();
+  if (o.Has("requestsPerSecond") && o.Get("requestsPerSecond").IsNumber()) l.requestsPerSecond = o.Get("requestsPerSecond").As<Napi::Number>().DoubleValue();
+  if (o.Has("bytesPerSecond") && o.Get("bytesPerSecond").IsNumber()) l.bytesPerSecond = o.Get("bytesPerSecond").As<Napi::Number>().DoubleValue();
+  if (o.Has("burst") && o.Get("burst").IsNumber()) l.burst = o.Get("burst").As<Napi::Number>().DoubleValue();
+}
+
+// AIMD on each origin's concurrency: +increase per healthy window of
+// completions, *decrease on 429/503, timeouts or a p90 latency spike.
+struct AdaptiveConfig {
+  bool enabled{false};
+  double min{1};
+  double max{256};
+  double initial{4};
+  double increase{1};
+  double decrease{0.5};
+  double latencyFactor{2};
+};
+
+static void parseAdaptiveConfig(Napi::Object o, AdaptiveConfig& a) {
+  auto num = [&](const char* k, double& dst) {
+    if (o.Has(k) && o.Get(k).IsNumber()) dst = o.Get(k).As<Napi::Number>().DoubleValue();
+  };
+  num("min", a.min);
+  num("max", a.max);
+  num("initial", a.initial);
+  num("increase", a.increase);
+  num("decrease", a.decrease);
+  num("latencyFactor", a.latencyFactor);
+  a.min = std::max(1.0, a.min);
+  a.max = std::max(a.min, a.max);
+  a.initial = std::min(a.max, std::max(a.min, a.initial));
+}
+
+struct LearnedLimit {
+  double limit{0};
+  double p90{0};
+};
+
+enum Lane : uint8_t { kLaneInteractive, kLaneBulk, kLaneCount };
+
+// Engine-side queue for one origin. Lanes are served in strict priority
+// order as concurrency and request tokens allow; the byte bucket pauses
+// transfers from the write callback once it runs dry.
+struct OriginQueue {
+  bool idle() const {
+    for (auto& l : lanes) if (!l.empty()) return false;
+    return active == 0 && paused.empty() && !listed && (!requests.limited() || requests.tokens >= requests.burst) && (!bytes.limited() || bytes.tokens >= bytes.burst);
+  }
+
+  uint32_t cap() const {
+    if (limit <= 0) return limits.maxConcurrency;
+    return limits.maxConcurrency ? std::min(limits.maxConcurrency, (uint32_t)limit) : (uint32_t)limit;
+  }
+
+  OriginLimits limits;
+  uint32_t active{0};
+  // Adaptive concurrency; limit stays 0 when the controller is off.
+  double limit{0};
+  double baseP90{0};
+  int64_t lastCut{0};
+  std::vector<uint32_t> window;
+  // Latency of the last completions, in ms, for hedge delays.
+  int64_t percentileMs(double q) const {
+    uint32_t n = std::min<uint32_t>(recentCount, 64);
+    if (n < 16) return -1;
+    uint32_t copy[64];
+    std::copy(recent, recent + n, copy);
+    std::nth_element(copy, copy + (size_t)(q * (n - 1)), copy + n);
+    return copy[(size_t)(q * (n - 1))];
+  }
+  void sample(uint32_t ms) { recent[recentCount++ % 64] = ms; }
+  uint32_t recent[64]{};
+  uint32_t recentCount{0};
+  TokenBucket requests;
+  TokenBucket bytes;
+  std::deque<Transfer*> lanes[kLaneCount];
+  std::vector<Transfer*> paused;
+  bool listed{false};
+  // Engine thread: lists the origin to be pumped again in `wait` ms.
+  std::function<void(OriginQueue*, int64_t)> throttle;
+};
+
+enum TransferPhase : uint8_t { kXferQueued, kXferConnecting, kXferWaiting, kXferHeaders, kXferBody, kXferPhaseCount };
+static const char* const kXferPhaseNames[kXferPhaseCount] = { "queued", "connecting", "waiting", "headers", "body" };
+
+// Takes finished transfers on the engine thread instead of the JS settle
+// queue. Used by the job runner.
+struct TransferSink {
+  virtual void deliver(Transfer* t) = 0;
+protected:
+  ~TransferSink() {}
+};
+
+// Results of one fetchMany() call. Settled results wait in `ready` until
+// next() asks for them; next() calls made early wait in `waiters`. JS thread
+// only.
+struct Batch {
+  std::shared_ptr<RequestGroup> group;
+  std::deque<Napi::ObjectReference> ready;
+  std::deque<Napi::Promise::Deferred> waiters;
+  uint32_t remaining{0};
+  bool closed{false};
+  Napi::ObjectReference signal;
+  Napi::FunctionReference onAbort;
+};
+
+// One fetch from submit to settle. The easy handle outlives the fetch() call
+// that built it, so everything curl keeps a pointer to lives here.
+struct Transfer {
+  Transfer() {}
+  explicit Transfer(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+  ~Transfer() {
+    if (curl) curl_easy_cleanup(curl);
+    if (headers) curl_slist_free_all(headers);
+    if (resolve) curl_slist_free_all(resolve);
+  }
+
+  // Empty for hedges, which settle through their primary, for fetchMany()
+  // members, which settle into their batch, and in callback mode.
+  std::optional<Napi::Promise::Deferred> deferred;
+  Napi::FunctionReference callback;
+  std::shared_ptr<Batch> batch;
+  uint32_t index{0};
+  TransferSink* sink{nullptr};
+  CURL* curl{nullptr};
+  uint64_t id{0};
+  std::string url;
+  std::string method;
+  std::string host;
+  std::string body;
+  std::string sessionId;
+  std::string proxy;
+  std::string origin;
+  std::shared_ptr<RequestGroup> group;
+  uint32_t timeoutMs{0};
+  uint8_t lane{kLaneInteractive};
+  // Engine thread only: which queues hold the transfer.
+  OriginQueue* queue{nullptr};
+  bool admitted{false};
+  bool added{false};
+  bool originProbe{false};
+  bool proxyProbe{false};
+  // Hedging: -1 off, 0 after the origin's observed percentile, else ms.
+  int32_t hedgeDelay{-1};
+  // The cookies the handle was loaded with; a hedge's duplicate handle
+  // does not inherit them.
+  std::vector<std::string> hedgeJar;
+  Transfer* primary{nullptr};
+  Transfer* hedge{nullptr};
+  bool primaryFailed{false};
+  bool paused{false};
+  int proxyIdx{-1};
+  // Set once in BuildTransfer; proxyIdx is already -1 by the time a pooled
+  // transfer finishes.
+  bool pooledProxy{false};
+  std::vector<int> triedProxies;
+  int localIdx{-1};
+  curl_slist* headers{nullptr};
+  // The client's prebuilt list, used instead of `headers` when the request
+  // adds nothing to it.
+  std::shared_ptr<curl_slist> sharedHeaders;
+  curl_slist* resolve{nullptr};
+  std::shared_ptr<curl_slist> sharedResolve;
+  SocketTuning socket;
+  DeadlineWatch watch;
+  TraceCtx trace{nullptr, 0};
+  HeaderCollector hc;
+  std::string respBody;
+  char errbuf[CURL_ERROR_SIZE]{};
+  bool wantTimings{false};
+  int64_t submitted{0};
+  // Written by the engine thread, read by inflight().
+  std::atomic<uint8_t> phase{kXferQueued};
+  std::atomic<uint64_t> bytesDown{0};
+  std::atomic<int64_t> connectionId{-1};
+  // Results, filled in on the engine thread before the transfer is handed back.
+  CURLcode rc{CURLE_OK};
+  bool cancelled{false};
+  long status{0};
+  std::string finalUrl;
+  TransferTimings tm;
+  std::vector<std::string> cookies;
+  // The session's cookie store to write back to; the client's when empty.
+  std::shared_ptr<std::vector<std::string>> jar;
+  // AbortSignal passed to fetch() and the listener registered on it.
+  Napi::ObjectReference signal;
+  Napi::FunctionReference onAbort;
+};
+
+static size_t xfer_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata) {
+  Transfer* t = reinterpret_cast<Transfer*>(userdata);
+  size_t len = size * nmemb;
+  if (OriginQueue* q = t->queue) {
+    if (q->bytes.limited()) {
+      q->bytes.refill(nowMs());
+      if (q->bytes.tokens <= 0) {
+        t->paused = true;
+        q->paused.push_back(t);
+        // A listed origin is pumped anyway; otherwise nothing would resume it.
+        if (!q->listed) q->throttle(q, q->bytes.wait(1));
+        return CURL_WRITEFUNC_PAUSE;
+      }
+      q->bytes.tokens -= len;
+    }
+  }
+  if (RequestGroup* g = t->group.get()) {
+    uint64_t total = g->bytes.fetch_add(len, std::memory_order_relaxed) + len;
+    if (g->maxBytes && total > g->maxBytes) {
+      g->end("maxBytes");
+      return 0;
+    }
+  }
+  t->respBody.append(ptr, len);
+  t->phase.store(kXferBody, std::memory_order_relaxed);
+  t->bytesDown.store(t->respBody.size(), std::memory_order_relaxed);
+  CURLNAPI_PROBE4(body__chunk, t->id, t->host.c_str(), len, t->respBody.size());
+  return len;
+}
+
+static size_t xfer_header_cb(char* buffer, size_t size, size_t nitems, void* userdata) {
+  Transfer* t = reinterpret_cast<Transfer*>(userdata);
+  t->phase.store(kXferHeaders, std::memory_order_relaxed);
+  return header_cb(buffer, size, nitems, &t->hc);
+}
+
+// Called once the connection is ready and the request is about to be sent.
+static int xfer_prereq_cb(void* clientp, char* connPrimaryIp, char* connLocalIp, int connPrimaryPort, int connLocalPort) {
+  Transfer* t = reinterpret_cast<Transfer*>(clientp);
+  curl_off_t conn = -1;
+  if (curl_easy_getinfo(t->curl, CURLINFO_CONN_ID, &conn) == CURLE_OK) t->connectionId.store(conn, std::memory_order_relaxed);
+  t->phase.store(kXferWaiting, std::memory_order_relaxed);
+  return CURL_PREREQFUNC_OK;
+}
+
+// Runs all transfers of one client on a curl multi handle in a worker
+// thread. fetch() builds the easy handle on the JS thread and submits it;
+// finished transfers are queued for take() and announced through notify.
+class Engine {
+public:
+  struct Hooks {
+    // Engine thread: re-arm a finished transfer for another attempt.
+    std::function<bool(Transfer*)> retry;
+    // Engine thread: read the results off the handle.
+    std::function<void(Transfer*)> finish;
+    // Engine thread: take() went from empty to non-empty.
+    std::function<void()> notify;
+    // Engine thread: build a duplicate of a running transfer, or null.
+    std::function<Transfer*(Transfer*)> hedge;
+    // Engine thread: a hedge attempt is over; returns its pooled proxy.
+    std::function<void(Transfer*)> discard;
+  };
+
+  ~Engine() { stop(); }
+
+  // Scheduler limits are fixed before start(); per-origin overrides win
+  // over the defaults.
+  OriginLimits defaultLimits;
+  std::map<std::string, OriginLimits> originLimits;
+  AdaptiveConfig adaptive;
+  // Each hedge-eligible launch earns hedgeBudget hedges.
+  double hedgeBudget{0.1};
+  double hedgePercentile{0.95};
+  std::atomic<uint64_t> hedgesFired{0};
+  std::atomic<uint64_t> hedgesWon{0};
+  std::atomic<uint64_t> hedgesDenied{0};
+  // Completions are handed to JS in one notify once batchMax are waiting or
+  // the oldest has waited batchDelay ms; 0 means no limit / no wait.
+  size_t batchMax{0};
+  int64_t batchDelay{0};
+
+  // Seeds or restores learned limits; only takes effect for origins the
+  // engine has not queued yet.
+  void seedLimit(const std::string& origin, double limit) {
+    std::lock_guard<std::mutex> lock(mu);
+    learned[origin].limit = std::min(adaptive.max, std::max(adaptive.min, limit));
+  }
+
+  std::map<std::string, LearnedLimit> learnedLimits() {
+    std::lock_guard<std::mutex> lock(mu);
+    return learned;
+  }
+
+  void start(Hooks h) {
+    hooks = std::move(h);
+    multi = curl_multi_init();
+    worker = std::thread([this]{ run(); });
+  }
+
+  // Transfers still running are dropped without being settled; the client
+  // only goes away once nothing is in flight.
+  void stop() {
+    if (!multi) return;
+    stopping = true;
+    curl_multi_wakeup(multi);
+    worker.join();
+    for (auto& kv : live) {
+      if (kv.second->added) curl_multi_remove_handle(multi, kv.second->curl);
+      if (Transfer* x = kv.second->hedge) {
+        curl_multi_remove_handle(multi, x->curl);
+        delete x;
+      }
+      delete kv.second;
+    }
+    for (Transfer* t : done) delete t;
+    live.clear();
+    incoming.clear();
+    done.clear();
+    curl_multi_cleanup(multi);
+    multi = nullptr;
+  }
+
+  void submit(Transfer* t) {
+    curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      live[t->id] = t;
+      incoming.push_back(t);
+    }
+    curl_multi_wakeup(multi);
+  }
+
+  // One lock and one wakeup for a whole batch.
+  void submit(const std::vector<Transfer*>& ts) {
+    for (Transfer* t : ts) curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      for (Transfer* t : ts) {
+        live[t->id] = t;
+        incoming.push_back(t);
+      }
+    }
+    curl_multi_wakeup(multi);
+  }
+
+  bool cancel(uint64_t id) {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      if (!live.count(id)) return false;
+      cancels.push_back(id);
+    }
+    curl_multi_wakeup(multi);
+    return true;
+  }
+
+  void cancelGroup(const std::shared_ptr<RequestGroup>& g, const char* reason) {
+    g->end(reason);
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      endedGroups.push_back(g);
+    }
+    curl_multi_wakeup(multi);
+  }
+
+  // Up to batchMax finished transfers. `more` is set when some are left,
+  // and the caller is expected to come back for them.
+  std::vector<Transfer*> take(bool& more) {
+    std::vector<Transfer*> out;
+    std::lock_guard<std::mutex> lock(mu);
+    size_t n = batchMax && done.size() > batchMax ? batchMax : done.size();
+    out.assign(done.begin(), done.begin() + n);
+    done.erase(done.begin(), done.begin() + n);
+    more = !done.empty();
+    if (!more) notified = false;
+    return out;
+  }
+
+  // Visits live transfers under the engine lock; proxy and retry state
+  // only change while it is held.
+  template <typename F> void forEach(F f) {
+    std::lock_guard<std::mutex> lock(mu);
+    for (auto& kv : live) f(*kv.second);
+  }
+
+private:
+  void run() {
+    std::vector<Transfer*> adds;
+    std::vector<uint64_t> drops;
+    int running = 0;
+    while (!stopping) {
+      {
+        std::lock_guard<std::mutex> lock(mu);
+        adds.swap(incoming);
+        drops.swap(cancels);
+        tear.insert(tear.end(), endedGroups.begin(), endedGroups.end());
+        endedGroups.clear();
+      }
+      for (Transfer* t : adds) admit(t);
+      adds.clear();
+      for (uint64_t id : drops) {
+        Transfer* t = nullptr;
+        {
+          std::lock_guard<std::mutex> lock(mu);
+          auto it = live.find(id);
+          if (it != live.end()) t = it->second;
+        }
+        if (t) drop(t);
+      }
+      drops.clear();
+      curl_multi_perform(multi, &running);
+      int queued = 0;
+      while (CURLMsg* m = curl_multi_info_read(multi, &queued)) {
+        if (m->msg != CURLMSG_DONE) continue;
+        Transfer* t = nullptr;
+        curl_easy_getinfo(m->easy_handle, CURLINFO_PRIVATE, &t);
+        t->rc = m->data.result;
+        curl_multi_remove_handle(multi, t->curl);
+        if (t->primary) {
+          hedgeDone(t);
+          continue;
+        }
+        bool again = false;
+        {
+          std::lock_guard<std::mutex> lock(mu);
+          again = hooks.retry && hooks.retry(t);
+        }
+        if (again) {
+          if (t->paused) {
+            erase(t->queue->paused, t);
+            t->paused = false;
+          }
+          t->watch.start = nowMs();
+          curl_multi_add_handle(multi, t->curl);
+          continue;
+        }
+        // A failed primary waits for its hedge before giving up.
+        if (t->rc != CURLE_OK && t->hedge) {
+          t->primaryFailed = true;
+          continue;
+        }
+        complete(t);
+      }
+      for (size_t i = 0; i < tear.size(); ++i) teardown(tear[i].get());
+      tear.clear();
+      int64_t wait = dispatch();
+      int64_t hedgeWait = fireHedges();
+      if (hedgeWait >= 0 && (wait < 0 || hedgeWait < wait)) wait = hedgeWait;
+      int64_t flushWait = flush();
+      if (flushWait >= 0 && (wait < 0 || flushWait < wait)) wait = flushWait;
+      // Phase deadlines are checked from the progress callback, which only
+      // runs when curl gets to the handle; wake often while any are armed.
+      int timeout = watched > 0 ? 20 : 1000;
+      if (wait >= 0 && wait < timeout) timeout = (int)wait;
+      curl_multi_poll(multi, nullptr, 0, timeout, nullptr);
+    }
+  }
+
+  // Group admission first, then the origin queue.
+  void admit(Transfer* t) {
+    if (RequestGroup* g = t->group.get()) {
+      if (g->ended()) return drop(t);
+      if (g->maxConcurrency && g->active.load() >= g->maxConcurrency) {
+        g->pending.push_back(t);
+        g->queued++;
+        return;
+      }
+      g->active++;
+    }
+    t->admitted = true;
+    enqueue(t);
+  }
+
+  void enqueue(Transfer* t) {
+    auto it = origins.find(t->origin);
+    if (it == origins.end()) {
+      it = origins.emplace(t->origin, OriginQueue()).first;
+      auto lim = originLimits.find(t->origin);
+      OriginQueue& q = it->second;
+      q.limits = lim != originLimits.end() ? lim->second : defaultLimits;
+      q.requests.configure(q.limits.requestsPerSecond, q.limits.burst);
+      q.bytes.configure(q.limits.bytesPerSecond, q.limits.bytesPerSecond);
+      q.requests.last = q.bytes.last = nowMs();
+      q.throttle = [this](OriginQueue* q, int64_t wait) { throttle(q, nowMs(), wait); };
+      if (adaptive.enabled) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto l = learned.find(t->origin);
+        q.limit = l != learned.end() && l->second.limit > 0 ? l->second.limit : adaptive.initial;
+        if (l != learned.end()) q.baseP90 = l->second.p90;
+      }
+    }
+    t->queue = &it->second;
+    t->queue->lanes[t->lane].push_back(t);
+    markReady(t->queue);
+  }
+
+  void markReady(OriginQueue* q) {
+    if (q->listed) return;
+    q->listed = true;
+    ready.push_back(q);
+  }
+
+  // Starts whatever the origin limits allow and returns ms until a
+  // throttled origin has tokens again, or -1.
+  int64_t dispatch() {
+    int64_t now = nowMs();
+    if (wakeAt && now >= wakeAt) {
+      for (OriginQueue* q : throttled) ready.push_back(q);
+      throttled.clear();
+      wakeAt = 0;
+    }
+    for (size_t i = 0; i < ready.size(); ++i) pump(ready[i], now);
+    ready.clear();
+    if (origins.size() > 1024) {
+      for (auto it = origins.begin(); it != origins.end();) {
+        if (it->second.idle()) it = origins.erase(it);
+        else ++it;
+      }
+    }
+    return wakeAt ? std::max<int64_t>(0, wakeAt - now) : -1;
+  }
+
+  void pump(OriginQueue* q, int64_t now) {
+    q->listed = false;
+    q->requests.refill(now);
+    q->bytes.refill(now);
+    int64_t wait = 0;
+    if (!q->paused.empty()) {
+      if (q->bytes.tokens > 0) {
+        std::vector<Transfer*> resume;
+        resume.swap(q->paused);
+        for (Transfer* t : resume) {
+          t->paused = false;
+          curl_easy_pause(t->curl, CURLPAUSE_CONT);
+        }
+      } else {
+        wait = q->bytes.wait(1);
+      }
+    }
+    for (;;) {
+      Transfer* t = nullptr;
+      for (auto& lane : q->lanes) {
+        if (!lane.empty()) {
+          t = lane.front();
+          break;
+        }
+      }
+      if (!t || (q->cap() && q->active >= q->cap())) break;
+      if (q->requests.limited() && q->requests.tokens < 1) {
+        wait = std::max<int64_t>(wait, q->requests.wait(1));
+        break;
+      }
+      if (q->bytes.limited() && q->bytes.tokens <= 0) {
+        wait = std::max<int64_t>(wait, q->bytes.wait(1));
+        break;
+      }
+      q->lanes[t->lane].pop_front();
+      if (q->requests.limited()) q->requests.tokens -= 1;
+      launch(t);
+    }
+    if (wait > 0) throttle(q, now, wait);
+  }
+
+  void throttle(OriginQueue* q, int64_t now, int64_t wait) {
+    q->listed = true;
+    throttled.push_back(q);
+    if (!wakeAt || now + wait < wakeAt) wakeAt = now + wait;
+  }
+
+  void launch(Transfer* t) {
+    RequestGroup* g = t->group.get();
+    // Capping each transfer's timeout at the group deadline lets curl end
+    // them; the first one to hit it tears down the rest.
+    if (g && g->deadline) {
+      int64_t left = g->deadline - nowMs();
+      if (left <= 0) {
+        g->end("deadline");
+        return drop(t);
+      }
+      if (t->timeoutMs == 0 || left < t->timeoutMs) curl_easy_setopt(t->curl, CURLOPT_TIMEOUT_MS, (long)left);
+    }
+    t->phase.store(kXferConnecting, std::memory_order_relaxed);
+    t->watch.start = nowMs();
+    if (t->watch.limits.any()) watched++;
+    t->added = true;
+    t->queue->active++;
+    curl_multi_add_handle(multi, t->curl);
+    if (t->hedgeDelay >= 0) {
+      hedgeTokens = std::min(10.0, hedgeTokens + hedgeBudget);
+      int64_t delay = t->hedgeDelay > 0 ? t->hedgeDelay : t->queue->percentileMs(hedgePercentile);
+      if (delay >= 0) hedgeTimers.emplace(t->watch.start + delay, t->id);
+    }
+  }
+
+  // Starts hedges that are due and returns ms until the next one, or -1.
+  int64_t fireHedges() {
+    int64_t now = nowMs();
+    while (!hedgeTimers.empty() && hedgeTimers.begin()->first <= now) {
+      uint64_t id = hedgeTimers.begin()->second;
+      hedgeTimers.erase(hedgeTimers.begin());
+      Transfer* t = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = live.find(id);
+        if (it != live.end()) t = it->second;
+      }
+      // Only worth it while no response has started to arrive.
+      if (!t || !t->added || t->hedge || t->primaryFailed || t->phase.load(std::memory_order_relaxed) >= kXferHeaders) continue;
+      RequestGroup* g = t->group.get();
+      if (hedgeTokens < 1 || (g && g->maxConcurrency && g->active.load() >= g->maxConcurrency)) {
+        hedgesDenied++;
+        continue;
+      }
+      Transfer* x = hooks.hedge ? hooks.hedge(t) : nullptr;
+      if (!x) continue;
+      hedgeTokens -= 1;
+      hedgesFired++;
+      x->primary = t;
+      t->hedge = x;
+      // The hedge draws on the origin's byte bucket and takes a slot and
+      // bytes from the group like any member; release() gives them back.
+      x->queue = t->queue;
+      x->lane = t->lane;
+      x->group = t->group;
+      if (g) {
+        g->active++;
+        x->admitted = true;
+      }
+      curl_multi_add_handle(multi, x->curl);
+    }
+    return hedgeTimers.empty() ? -1 : std::max<int64_t>(0, hedgeTimers.begin()->first - now);
+  }
+
+  // The first successful response wins. A winning hedge hands its handle
+  // and results to the primary, which is the one that settles.
+  void hedgeDone(Transfer* x) {
+    Transfer* t = x->primary;
+    t->hedge = nullptr;
+    if (x->rc != CURLE_OK) {
+      if (hooks.discard) hooks.discard(x);
+      release(x);
+      delete x;
+      if (t->primaryFailed) complete(t);
+      return;
+    }
+    hedgesWon++;
+    if (!t->primaryFailed) curl_multi_remove_handle(multi, t->curl);
+    std::swap(t->curl, x->curl);
+    std::swap(t->respBody, x->respBody);
+    std::swap(t->hc, x->hc);
+    std::swap(t->errbuf, x->errbuf);
+    std::swap(t->watch, x->watch);
+    t->watch.curl = t->curl;
+    curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+    curl_easy_setopt(t->curl, CURLOPT_ERRORBUFFER, t->errbuf);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, t);
+    curl_easy_setopt(t->curl, CURLOPT_HEADERDATA, t);
+    curl_easy_setopt(t->curl, CURLOPT_PREREQDATA, t);
+    curl_easy_setopt(t->curl, CURLOPT_XFERINFODATA, &t->watch);
+    t->rc = CURLE_OK;
+    t->bytesDown.store(t->respBody.size(), std::memory_order_relaxed);
+    x->rc = CURLE_ABORTED_BY_CALLBACK;
+    x->cancelled = true;
+    {
+      // Both pooled proxies go back now, the winner's as a success.
+      std::lock_guard<std::mutex> lock(mu);
+      std::swap(t->proxy, x->proxy);
+      std::swap(t->proxyIdx, x->proxyIdx);
+      if (hooks.discard) {
+        hooks.discard(x);
+        hooks.discard(t);
+      }
+    }
+    release(x);
+    delete x;
+    complete(t);
+  }
+
+  void drop(Transfer* t) {
+    if (t->added) curl_multi_remove_handle(multi, t->curl);
+    t->rc = CURLE_ABORTED_BY_CALLBACK;
+    t->cancelled = true;
+    complete(t);
+  }
+
+  // Removes every transfer of an ended group in one pass.
+  void teardown(RequestGroup* g) {
+    if (g->tornDown) return;
+    g->tornDown = true;
+    std::vector<Transfer*> victims;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      for (auto& kv : live) {
+        if (kv.second->group.get() == g) victims.push_back(kv.second);
+      }
+    }
+    for (Transfer* t : victims) drop(t);
+  }
+
+  template <typename C> static void erase(C& c, Transfer* t) {
+    auto it = std::find(c.begin(), c.end(), t);
+    if (it != c.end()) c.erase(it);
+  }
+
+  // Frees the transfer's slots. Waiting transfers are started by the next
+  // dispatch(), never from here, so a chain of drops cannot recurse.
+  void release(Transfer* t) {
+    if (OriginQueue* q = t->queue) {
+      if (t->added) q->active--;
+      else erase(q->lanes[t->lane], t);
+      if (t->paused) erase(q->paused, t);
+      markReady(q);
+    }
+    if (RequestGroup* g = t->group.get()) {
+      if (t->admitted) {
+        g->active--;
+      } else if (std::find(g->pending.begin(), g->pending.end(), t) != g->pending.end()) {
+        erase(g->pending, t);
+        g->queued--;
+      }
+      while (!g->ended() && !g->pending.empty() && (!g->maxConcurrency || g->active.load() < g->maxConcurrency)) {
+        Transfer* next = g->pending.front();
+        g->pending.pop_front();
+        g->queued--;
+        g->active++;
+        next->admitted = true;
+        enqueue(next);
+      }
+      if (g->ended() && !g->tornDown) tear.push_back(t->group);
+    }
+  }
+
+  void complete(Transfer* t) {
+    if (Transfer* x = t->hedge) {
+      curl_multi_remove_handle(multi, x->curl);
+      x->rc = CURLE_ABORTED_BY_CALLBACK;
+      x->cancelled = true;
+      if (hooks.discard) hooks.discard(x);
+      release(x);
+      delete x;
+      t->hedge = nullptr;
+    }
+    if (t->added && t->watch.limits.any()) watched--;
+    release(t);
+    if (RequestGroup* g = t->group.get()) {
+      if (t->rc == CURLE_OPERATION_TIMEDOUT && g->deadline && nowMs() >= g->deadline && g->end("deadline")) tear.push_back(t->group);
+      if (t->rc == CURLE_OK) g->completed++;
+      else g->failed++;
+      g->latency.record((uint64_t)(nowMs() - t->submitted) * 1000);
+    }
+    if (hooks.finish) hooks.finish(t);
+    if (t->added && t->rc == CURLE_OK) t->queue->sample((uint32_t)(nowMs() - t->watch.start));
+    if (adaptive.enabled && t->added && !t->cancelled) adapt(t->queue, t);
+    if (TransferSink* sink = t->sink) {
+      {
+        std::lock_guard<std::mutex> lock(mu);
+        live.erase(t->id);
+      }
+      sink->deliver(t);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mu);
+    live.erase(t->id);
+    if (done.empty()) doneSince = nowMs();
+    done.push_back(t);
+  }
+
+  // Completions of one loop turn go out in a single notify, held back up to
+  // batchDelay for more to arrive. Returns ms until the hold expires, or -1.
+  int64_t flush() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      if (done.empty() || notified) return -1;
+      if (batchDelay > 0 && (!batchMax || done.size() < batchMax)) {
+        int64_t left = doneSince + batchDelay - nowMs();
+        if (left > 0) return left;
+      }
+      notified = true;
+    }
+    if (hooks.notify) hooks.notify();
+    return -1;
+  }
+
+  void adapt(OriginQueue* q, Transfer* t) {
+    int64_t now = nowMs();
+    bool overload = t->rc == CURLE_OPERATION_TIMEDOUT || t->status == 429 || t->status == 503;
+    if (overload) {
+      // Concurrent failures from one overload event count as one cut.
+      if (now - q->lastCut > std::max<int64_t>(100, (int64_t)q->baseP90)) {
+        q->limit = std::max(adaptive.min, q->limit * adaptive.decrease);
+        q->lastCut = now;
+        q->window.clear();
+      }
+    } else if (t->rc != CURLE_OK) {
+      // Refused, reset or unresolved: fast, but not a healthy latency sample.
+      return;
+    } else {
+      q->window.push_back((uint32_t)(now - t->watch.start));
+      if (q->window.size() < std::max<size_t>(8, (size_t)q->limit)) return;
+      auto nth = q->window.begin() + q->window.size() * 9 / 10;
+      std::nth_element(q->window.begin(), nth, q->window.end());
+      double p90 = *nth;
+      q->window.clear();
+      if (q->baseP90 > 0 && p90 > q->baseP90 * adaptive.latencyFactor) {
+        q->limit = std::max(adaptive.min, q->limit * adaptive.decrease);
+        q->lastCut = now;
+      } else {
+        q->limit = std::min(adaptive.max, q->limit + adaptive.increase);
+      }
+      // The baseline follows the best p90 seen and drifts up slowly so a
+      // host that got permanently slower is not cut forever.
+      q->baseP90 = q->baseP90 == 0 || p90 < q->baseP90 ? p90 : q->baseP90 * 0.95 + p90 * 0.05;
+    }
+    std::lock_guard<std::mutex> lock(mu);
+    LearnedLimit& l = learned[t->origin];
+    l.limit = q->limit;
+    l.p90 = q->baseP90;
+  }
+
+  Hooks hooks;
+  CURLM* multi{nullptr};
+  std::thread worker;
+  std::atomic<bool> stopping{false};
+  int watched{0};
+  std::mutex mu;
+  std::map<uint64_t, Transfer*> live;
+  std::vector<Transfer*> incoming;
+  std::vector<uint64_t> cancels;
+  std::vector<std::shared_ptr<RequestGroup>> endedGroups;
+  std::deque<Transfer*> done;
+  int64_t doneSince{0};
+  // Set from notify until JS has taken everything.
+  bool notified{false};
+  std::map<std::string, LearnedLimit> learned;
+  // Engine thread only.
+  std::vector<std::shared_ptr<RequestGroup>> tear;
+  std::map<std::string, OriginQueue> origins;
+  std::vector<OriginQueue*> ready;
+  std::vector<OriginQueue*> throttled;
+  int64_t wakeAt{0};
+  std::multimap<int64_t, uint64_t> hedgeTimers;
+  double hedgeTokens{1};
+};
+
+// What fetch() resolves its init to before building a handle. fetchMany()
+// parses the options shared by a batch once and copies them per request.
+struct RequestSpec {
+  std::string method{"GET"};
+  // The request's own headers; the client's are added by BuildTransfer.
+  std::vector<std::pair<std::string,std::string>> headers;
+  std::string body;
+  bool hasBody{false};
+  uint32_t timeoutMs{0};
+  PhaseDeadlines deadlines;
+  uint32_t lowSpeedLimit{0};
+  uint32_t lowSpeedTime{0};
+  bool timings{false};
+  bool forceHttp3{false};
+  std::string sessionId;
+  std::string localAddress;
+  int32_t hedgeDelay{-1};
+  uint8_t lane{kLaneInteractive};
+  std::shared_ptr<RequestGroup> group;
+  std::string proxy;
+  std::string proxyUser;
+  std::string proxyPass;
+  std::string proxyType;
+  std::string proxyAuth;
+  std::string noProxy;
+  bool ignoreProxyTls{false};
+  SocketTuning socket;
+  std::string unixSocket;
+  std::string abstractUnix;
+  uint32_t connectTimeout{0};
+  uint32_t maxRedirects{0};
+  int httpVersion{0};
+  std::string ipResolve;
+  std::string dohUrl;
+  std::string dohResolve;
+  bool ignoreDohTls{false};
+  std::string userAgent;
+  std::string referer;
+  std::string cookieJarPath;
+  // Prebuilt by compileProfile().
+  std::shared_ptr<curl_slist> headerList;
+  std::shared_ptr<curl_slist> resolveList;
+};
+
+// Every key the constructor or a request init accepts, in OptionId order.
+// Shared keys set the client's defaults in the constructor and override
+// them per request. Sessions take the shared keys and the ones that pin an
+// identity, never those describing a single request. Lookups go through a
+// collision-free hash built at compile time, so parsing costs one probe per
+// key actually present.
+enum OptionScope : uint8_t { kScopeClient = 1, kScopeRequest = 2, kScopeSession = 4, kScopeBoth = 7 };
+enum OptionType : uint8_t { kOptBool, kOptNumber, kOptString, kOptObject, kOptArray, kOptStringList, kOptNumberOrString, kOptAny };
+enum OptionId : uint8_t {
+  kOptVerbose, kOptDebug, kOptTrace, kOptTraceBufferSize, kOptScheduler, kOptCompletions, kOptCircuitBreaker,
+  kOptBrowser, kOptImpersonate, kOptMetrics, kOptMetricsMaxKeys, kOptIgnoreTlsErrors, kOptCaPath,
+  kOptFollowRedirects, kOptProxies, kOptProxyRotation, kOptProxyBanTime, kOptProxyMaxRetries,
+  kOptLocalAddresses, kOptLocalAddressMode, kOptLocalAddressSpillAt,
+  kOptHeaders, kOptTimeout, kOptTimeouts, kOptTimings, kOptLowSpeedLimit, kOptLowSpeedTime, kOptHedge,
+  kOptProxy, kOptProxyUrl, kOptProxyUsername, kOptProxyPassword, kOptProxyType, kOptProxyAuth, kOptNoProxy,
+  kOptIgnoreProxyTlsErrors, kOptUnixSocketPath, kOptAbstractUnixSocket, kOptSocket, kOptConnectTimeout,
+  kOptMaxRedirects, kOptHttpVersion, kOptForceHttp3, kOptIpResolve, kOptDohUrl, kOptDohResolve,
+  kOptIgnoreDohTlsErrors, kOptUserAgent, kOptReferer, kOptCookieJarPath,
+  kOptMethod, kOptBody, kOptSignal, kOptSessionId, kOptLocalAddress, kOptPriority, kOptGroup,
+  kOptionCount
+};
+
+struct OptionDef {
+  std::string_view name;
+  OptionId id;
+  OptionType type;
+  uint8_t scope;
+};
+
+static constexpr OptionDef kOptions[] = {
+  { "verbose", kOptVerbose, kOptBool, kScopeClient },
+  { "debug", kOptDebug, kOptBool, kScopeClient },
+  { "trace", kOptTrace, kOptBool, kScopeClient },
+  { "traceBufferSize", kOptTraceBufferSize, kOptNumber, kScopeClient },
+  { "scheduler", kOptScheduler, kOptObject, kScopeClient },
+  { "completions", kOptCompletions, kOptObject, kScopeClient },
+  { "circuitBreaker", kOptCircuitBreaker, kOptObject, kScopeClient },
+  { "browser", kOptBrowser, kOptString, kScopeClient },
+  { "impersonate", kOptImpersonate, kOptString, kScopeClient },
+  { "metrics", kOptMetrics, kOptBool, kScopeClient },
+  { "metricsMaxKeys", kOptMetricsMaxKeys, kOptNumber, kScopeClient },
+  { "ignoreTlsErrors", kOptIgnoreTlsErrors, kOptBool, kScopeClient },
+  { "caPath", kOptCaPath, kOptString, kScopeClient },
+  { "followRedirects", kOptFollowRedirects, kOptBool, kScopeClient },
+  { "proxies", kOptProxies, kOptArray, kScopeClient },
+  { "proxyRotation", kOptProxyRotation, kOptString, kScopeClient },
+  { "proxyBanTime", kOptProxyBanTime, kOptNumber, kScopeClient },
+  { "proxyMaxRetries", kOptProxyMaxRetries, kOptNumber, kScopeClient },
+  { "localAddresses", kOptLocalAddresses, kOptArray, kScopeClient },
+  { "localAddressMode", kOptLocalAddressMode, kOptString, kScopeClient },
+  { "localAddressSpillAt", kOptLocalAddressSpillAt, kOptNumber, kScopeClient },
+  { "headers", kOptHeaders, kOptAny, kScopeBoth },
+  { "timeout", kOptTimeout, kOptNumber, kScopeBoth },
+  { "timeouts", kOptTimeouts, kOptObject, kScopeBoth },
+  { "timings", kOptTimings, kOptBool, kScopeBoth },
+  { "lowSpeedLimit", kOptLowSpeedLimit, kOptNumber, kScopeBoth },
+  { "lowSpeedTime", kOptLowSpeedTime, kOptNumber, kScopeBoth },
+  { "hedge", kOptHedge, kOptAny, kScopeBoth },
+  { "proxy", kOptProxy, kOptString, kScopeBoth },
+  { "proxyUrl", kOptProxyUrl, kOptString, kScopeBoth },
+  { "proxy_username", kOptProxyUsername, kOptString, kScopeBoth },
+  { "proxy_password", kOptProxyPassword, kOptString, kScopeBoth },
+  { "proxy_type", kOptProxyType, kOptString, kScopeBoth },
+  { "proxy_auth", kOptProxyAuth, kOptString, kScopeBoth },
+  { "noProxy", kOptNoProxy, kOptStringList, kScopeBoth },
+  { "ignoreProxyTlsErrors", kOptIgnoreProxyTlsErrors, kOptBool, kScopeBoth },
+  { "unixSocketPath", kOptUnixSocketPath, kOptString, kScopeBoth },
+  { "abstractUnixSocket", kOptAbstractUnixSocket, kOptString, kScopeBoth },
+  { "socket", kOptSocket, kOptObject, kScopeBoth },
+  { "connectTimeout", kOptConnectTimeout, kOptNumber, kScopeBoth },
+  { "maxRedirects", kOptMaxRedirects, kOptNumber, kScopeBoth },
+  { "httpVersion", kOptHttpVersion, kOptNumberOrString, kScopeBoth },
+  { "force_http3", kOptForceHttp3, kOptBool, kScopeBoth },
+  { "ipResolve", kOptIpResolve, kOptString, kScopeBoth },
+  { "dohUrl", kOptDohUrl, kOptString, kScopeBoth },
+  { "dohResolve", kOptDohResolve, kOptString, kScopeBoth },
+  { "ignoreDohTlsErrors", kOptIgnoreDohTlsErrors, kOptBool, kScopeBoth },
+  { "userAgent", kOptUserAgent, kOptString, kScopeBoth },
+  { "referer", kOptReferer, kOptString, kScopeBoth },
+  { "cookieJarPath", kOptCookieJarPath, kOptString, kScopeBoth },
+  { "method", kOptMethod, kOptString, kScopeRequest },
+  { "body", kOptBody, kOptAny, kScopeRequest },
+  { "signal", kOptSignal, kOptObject, kScopeRequest },
+  { "sessionId", kOptSessionId, kOptString, kScopeRequest | kScopeSession },
+  { "localAddress", kOptLocalAddress, kOptString, kScopeRequest | kScopeSession },
+  { "priority", kOptPriority, kOptString, kScopeRequest },
+  { "group", kOptGroup, kOptObject, kScopeRequest }
+};
+static_assert(sizeof(kOptions) / sizeof(kOptions[0]) == kOptionCount, "kOptions must list every OptionId");
+
+constexpr bool optionsInOrder() {
+  for (size_t i = 0; i < kOptionCount; ++i) {
+    if (kOptions[i].id != i) return false;
+  }
+  return true;
+}
+static_assert(optionsInOrder(), "kOptions must be in OptionId order");
+
+constexpr uint32_t optionHash(std::string_view k, uint32_t seed) {
+  uint32_t h = seed;
+  for (char c : k) h = (h ^ (uint8_t)c) * 16777619u;
+  return h ^ (h >> 15);
+}
+
+constexpr size_t kOptionSlots = 512;
+
+struct OptionIndex {
+  uint8_t slot[kOptionSlots]{};
+};
+
+// Slot i holds option id + 1, or 0 when empty.
+constexpr bool buildOptionIndex(uint32_t seed, OptionIndex& index) {
+  for (size_t i = 0; i < kOptionSlots; ++i) index.slot[i] = 0;
+  for (size_t i = 0; i < kOptionCount; ++i) {
+    uint8_t& s = index.slot[optionHash(kOptions[i].name, seed) & (kOptionSlots - 1)];
+    if (s) return false;
+    s = (uint8_t)(i + 1);
+  }
+  return true;
+}
+
+constexpr uint32_t findOptionSeed() {
+  OptionIndex index;
+  for (uint32_t seed = 2166136261u;; ++seed) {
+    if (buildOptionIndex(seed, index)) return seed;
+  }
+}
+
+constexpr uint32_t kOptionSeed = findOptionSeed();
+
+constexpr OptionIndex makeOptionIndex() {
+  OptionIndex index;
+  buildOptionIndex(kOptionSeed, index);
+  return index;
+}
+
+static constexpr OptionIndex kOptionIndex = makeOptionIndex();
+
+static const OptionDef* findOption(std::string_view k) {
+  uint8_t s = kOptionIndex.slot[optionHash(k, kOptionSeed) & (kOptionSlots - 1)];
+  return s && kOptions[s - 1].name == k ? &kOptions[s - 1] : nullptr;
+}
+
+static bool optionTypeMatches(OptionType type, const Napi::Value& v) {
+  switch (type) {
+    case kOptBool: return v.IsBoolean();
+    case kOptNumber: return v.IsNumber();
+    case kOptString: return v.IsString();
+    case kOptObject: return v.IsObject();
+    case kOptArray: return v.IsArray();
+    case kOptStringList: return v.IsString() || v.IsArray();
+    case kOptNumberOrString: return v.IsNumber() || v.IsString();
+    case kOptAny: return true;
+  }
+  return false;
+}
+
+static const char* optionTypeName(OptionType type) {
+  switch (type) {
+    case kOptBool: return "a boolean";
+    case kOptNumber: return "a number";
+    case kOptString: return "a string";
+    case kOptObject: return "an object";
+    case kOptArray: return "an array";
+    case kOptStringList: return "a string or an array of strings";
+    case kOptNumberOrString: return "a number or a string";
+    case kOptAny: break;
+  }
+  return "valid";
+}
+
+// Why BuildTransfer refused a request; `key` is set for an open breaker.
+struct BuildError {
+  std::string message;
+  std::string key;
+  int64_t retryInMs{0};
+};
+
+static Napi::Value buildError(Napi::Env env, const BuildError& e) {
+  if (!e.key.empty()) return circuitOpenError(env, e.key, e.retryInMs).Value();
+  return Napi::Error::New(env, e.message).Value();
+}
+
+// Own enumerable string keys, as Object.keys() gives them; option objects
+// must not pick up keys from their prototype, which GetPropertyNames() does.
+static Napi::Array ownKeys(Napi::Env env, Napi::Object o) {
+  napi_value names;
+  napi_status status = napi_get_all_property_names(env, o, napi_key_own_only,
+    static_cast<napi_key_filter>(napi_key_enumerable | napi_key_skip_symbols), napi_key_numbers_to_strings, &names);
+  if (status != napi_ok) throw Napi::Error::New(env);
+  return Napi::Array(env, names);
+}
+
+static Napi::Object iterResult(Napi::Env env, Napi::Value value, bool done) {
+  Napi::Object r = Napi::Object::New(env);
+  r.Set("value", value);
+  r.Set("done", Napi::Boolean::New(env, done));
+  return r;
+}
+
+// Just enough JSON for job files: descriptors in, results out. Objects keep
+// their keys in `keys`, parallel to `items`.
+struct JsonValue {
+  enum Type { kNull, kBool, kNumber, kString, kArray, kObject } type{kNull};
+  bool boolean{false};
+  double number{0};
+  std::string str;
+  std::vector<std::string> keys;
+  std::vector<JsonValue> items;
+
+  const JsonValue* get(const char* key) const {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (keys[i] == key) return &items[i];
+    }
+    return nullptr;
+  }
+};
+
+class JsonReader {
+public:
+  explicit JsonReader(const std::string& text) : p(text.c_str()), end(text.c_str() + text.size()) {}
+
+  bool parse(JsonValue& v) {
+    if (!value(v, 0)) return false;
+    ws();
+    return p == end;
+  }
+
+private:
+  void ws() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
+  }
+
+  bool literal(const char* word) {
+    size_t n = strlen(word);
+    if ((size_t)(end - p) < n || memcmp(p, word, n) != 0) return false;
+    p += n;
+    return true;
+  }
+
+  static void utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) out.push_back((char)cp);
+    else if (cp < 0x800) {
+      out.push_back((char)(0xC0 | (cp >> 6)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+      out.push_back((char)(0xE0 | (cp >> 12)));
+      out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else {
+      out.push_back((char)(0xF0 | (cp >> 18)));
+      out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+      out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+  }
+
+  bool hex4(uint32_t& cp) {
+    if (end - p < 4) return false;
+    cp = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = *p++;
+      cp <<= 4;
+      if (c >= '0' && c <= '9') cp |= c - '0';
+      else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+      else return false;
+    }
+    return true;
+  }
+
+  bool string(std::string& out) {
+    if (p == end || *p != '"') return false;
+    ++p;
+    while (p < end) {
+      char c = *p++;
+      if (c == '"') return true;
+      if (c != '\\') {
+        out.push_back(c);
+        continue;
+      }
+      if (p == end) return false;
+      switch (*p++) {
+        case '"': out.push_back('"'); break;
+        case '\\': out.push_back('\\'); break;
+        case '/': out.push_back('/'); break;
+        case 'b': out.push_back('\b'); break;
+        case 'f': out.push_back('\f'); break;
+        case 'n': out.push_back('\n'); break;
+        case 'r': out.push_back('\r'); break;
+        case 't': out.push_back('\t'); break;
+        case 'u': {
+          uint32_t cp;
+          if (!hex4(cp)) return false;
+          if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+            p += 2;
+            uint32_t lo;
+            if (!hex4(lo)) return false;
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          }
+          utf8(out, cp);
+          break;
+        }
+        default: return false;
+      }
+    }
+    return false;
+  }
+
+  bool value(JsonValue& v, int depth) {
+    ws();
+    if (p == end || depth > 64) return false;
+    if (*p == '{' || *p == '[') {
+      bool object = *p++ == '{';
+      char close = object ? '}' : ']';
+      v.type = object ? JsonValue::kObject : JsonValue::kArray;
+      ws();
+      if (p < end && *p == close) {
+        ++p;
+        return true;
+      }
+      for (;;) {
+        if (object) {
+          ws();
+          v.keys.emplace_back();
+          if (!string(v.keys.back())) return false;
+          ws();
+          if (p == end || *p++ != ':') return false;
+        }
+        v.items.emplace_back();
+        if (!value(v.items.back(), depth + 1)) return false;
+        ws();
+        if (p == end) return false;
+        char c = *p++;
+        if (c == close) return true;
+        if (c != ',') return false;
+      }
+    }
+    if (*p == '"') {
+      v.type = JsonValue::kString;
+      return string(v.str);
+    }
+    if (literal("true")) {
+      v.type = JsonValue::kBool;
+      v.boolean = true;
+      return true;
+    }
+    if (literal("false")) {
+      v.type = JsonValue::kBool;
+      return true;
+    }
+    if (literal("null")) return true;
+    // The source is NUL-terminated, so strtod cannot run past it.
+    char* stop = nullptr;
+    v.number = strtod(p, &stop);
+    if (stop == p || stop > end) return false;
+    v.type = JsonValue::kNumber;
+    p = stop;
+    return true;
+  }
+
+  const char* p;
+  const char* end;
+};
+
+static void jsonString(std::string& out, const char* s, size_t n) {
+  out.push_back('"');
+  for (size_t i = 0; i < n; ++i) {
+    unsigned char c = (unsigned char)s[i];
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out.push_back((char)c);
+        }
+    }
+  }
+  out.push_back('"');
+}
+
+static void jsonString(std::string& out, const std::string& s) {
+  jsonString(out, s.data(), s.size());
+}
+
+static void jsonNumber(std::string& out, double v) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.17g", v);
+  out += buf;
+}
+
+static void writeJson(std::string& out, const JsonValue& v) {
+  switch (v.type) {
+    case JsonValue::kNull: out += "null"; break;
+    case JsonValue::kBool: out += v.boolean ? "true" : "false"; break;
+    case JsonValue::kNumber: jsonNumber(out, v.number); break;
+    case JsonValue::kString: jsonString(out, v.str); break;
+    case JsonValue::kArray:
+    case JsonValue::kObject: {
+      bool object = v.type == JsonValue::kObject;
+      out.push_back(object ? '{' : '[');
+      for (size_t i = 0; i < v.items.size(); ++i) {
+        if (i) out.push_back(',');
+        if (object) {
+          jsonString(out, v.keys[i]);
+          out.push_back(':');
+        }
+        writeJson(out, v.items[i]);
+      }
+      out.push_back(object ? '}' : ']');
+      break;
+    }
+  }
+}
+
+// Same fields as timingsToObject().
+static void timingsJson(std::string& out, const TransferTimings& t) {
+  char buf[512];
+  snprintf(buf, sizeof(buf),
+    "{\"dns\":%.3f,\"connect\":%.3f,\"tls\":%.3f,\"pretransfer\":%.3f,\"firstByte\":%.3f,\"redirect\":%.3f,\"total\":%.3f,"
+    "\"bytesUp\":%lld,\"bytesDown\":%lld,\"numConnects\":%ld,\"reused\":%s,\"httpVersion\":\"%s\",\"remotePort\":%ld,\"localPort\":%ld,",
+    t.namelookup / 1000.0, t.connect / 1000.0, t.appconnect / 1000.0, t.pretransfer / 1000.0, t.starttransfer / 1000.0,
+    t.redirect / 1000.0, t.total / 1000.0, (long long)(t.bytesUp + t.requestBytes), (long long)(t.bytesDown + t.headerBytes), t.numConnects,
+    connectionReused(t) ? "true" : "false", httpVersionName(t.httpVersion), t.remotePort, t.localPort);
+  out += buf;
+  out += "\"remoteIp\":";
+  jsonString(out, t.remoteIp);
+  out += ",\"localIp\":";
+  jsonString(out, t.localIp);
+  out.push_back('}');
+}
+
+static bool validUtf8(const std::string& s) {
+  const unsigned char* p = (const unsigned char*)s.data();
+  const unsigned char* end = p + s.size();
+  while (p < end) {
+    unsigned char c = *p++;
+    int n = c < 0x80 ? 0 : (c >> 5) == 0x6 ? 1 : (c >> 4) == 0xE ? 2 : (c >> 3) == 0x1E ? 3 : -1;
+    if (n < 0 || end - p < n) return false;
+    for (int i = 0; i < n; ++i) {
+      if ((*p++ & 0xC0) != 0x80) return false;
+    }
+  }
+  return true;
+}
+
+static std::string base64(const std::string& s) {
+  static const char* const kAlphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((s.size() + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 2 < s.size(); i += 3) {
+    uint32_t n = ((uint8_t)s[i] << 16) | ((uint8_t)s[i + 1] << 8) | (uint8_t)s[i + 2];
+    out.push_back(kAlphabet[n >> 18]);
+    out.push_back(kAlphabet[(n >> 12) & 63]);
+    out.push_back(kAlphabet[(n >> 6) & 63]);
+    out.push_back(kAlphabet[n & 63]);
+  }
+  if (i < s.size()) {
+    uint32_t n = (uint8_t)s[i] << 16;
+    if (i + 1 < s.size()) n |= (uint8_t)s[i + 1] << 8;
+    out.push_back(kAlphabet[n >> 18]);
+    out.push_back(kAlphabet[(n >> 12) & 63]);
+    out.push_back(i + 1 < s.size() ? kAlphabet[(n >> 6) & 63] : '=');
+    out.push_back('=');
+  }
+  return out;
+}
+
+// Content hash for result lines. Not cryptographic; the crypto library is
+// not linked on every platform.
+static std::string fnv1a64(const std::string& s) {
+  uint64_t h = 1469598103934665603ULL;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+  return buf;
+}
+
+// One runJobFile() call. The runner thread owns everything but `finished`,
+// which the engine fills as the job's transfers complete.
+struct JobRun : TransferSink {
+  enum BodyMode { kBodyInline, kBodyFile, kBodyHash, kBodyNone };
+
+  ~JobRun() {
+    for (Transfer* t : finished) delete t;
+  }
+
+  void deliver(Transfer* t) override {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      finished.push_back(t);
+    }
+    cv.notify_one();
+  }
+
+  void stop(bool now) {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      stopping = true;
+      abandon = abandon || now;
+    }
+    cv.notify_one();
+  }
+
+  std::string inPath;
+  std::string outPath;
+  std::string bodyDir;
+  BodyMode bodyMode{kBodyInline};
+  uint32_t concurrency{16};
+  RequestSpec base;
+  std::vector<std::string> cookies;
+  std::shared_ptr<RequestGroup> group;
+  std::thread thread;
+  std::mutex mu;
+  std::condition_variable cv;
+  std::vector<Transfer*> finished;
+  // Stopping lets running requests finish; abandoning drops them.
+  bool stopping{false};
+  bool abandon{false};
+  // Written by the runner, read once it is done.
+  uint64_t succeeded{0};
+  uint64_t failed{0};
+  uint64_t skipped{0};
+  uint64_t resumedAt{0};
+  bool complete{false};
+  std::string error;
+  Napi::ThreadSafeFunction doneFn;
+  std::optional<Napi::Promise::Deferred> deferred;
+  Napi::ObjectReference signal;
+  Napi::FunctionReference onAbort;
+};
+
+// Per-environment state.
+struct AddonData {
+  Napi::FunctionReference responseCtor;
+  Napi::FunctionReference headersCtor;
+  Napi::FunctionReference profileCtor;
+  Napi::FunctionReference sessionCtor;
+};
+
+// A response's headers, read straight from the native block. Names are
+// matched case-insensitively through an index built on the first lookup,
+// and JS strings are only made for what is actually read.
+class ImpitHeaders : public Napi::ObjectWrap<ImpitHeaders> {
+public:
+  static Napi::Function InitClass(Napi::Env env) {
+    Napi::Function ctor = DefineClass(env, "ImpitHeaders", {
+      InstanceMethod<&ImpitHeaders::Get>("get"),
+      InstanceMethod<&ImpitHeaders::Has>("has"),
+      InstanceMethod<&ImpitHeaders::GetSetCookie>("getSetCookie"),
+      InstanceMethod<&ImpitHeaders::Entries>("entries"),
+      InstanceMethod<&ImpitHeaders::Keys>("keys"),
+      InstanceMethod<&ImpitHeaders::Values>("values"),
+      InstanceMethod<&ImpitHeaders::ForEach>("forEach")
+    });
+    Napi::Object proto = ctor.Get("prototype").As<Napi::Object>();
+    proto.Set(Napi::Symbol::WellKnown(env, "iterator"), proto.Get("entries"));
+    return ctor;
+  }
+
+  ImpitHeaders(const Napi::CallbackInfo& info) : Napi::ObjectWrap<ImpitHeaders>(info) {}
+
+  static Napi::Object Create(Napi::Env env, std::shared_ptr<const HeaderCollector> h) {
+    Napi::Object o = env.GetInstanceData<AddonData>()->headersCtor.New({});
+    Unwrap(o)->h = std::move(h);
+    return o;
+  }
+
+private:
+  static std::string lower(std::string_view s) {
+    std::string out(s);
+    for (auto& c : out) c = (char)std::tolower((unsigned char)c);
+    return out;
+  }
+
+  // Field indices per lowercased name, in arrival order.
+  const std::vector<uint32_t>* find(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1) throw Napi::TypeError::New(info.Env(), "Header name is required");
+    if (!indexed) {
+      for (uint32_t i = 0; i < h->size(); ++i) byName[lower(h->name(i))].push_back(i);
+      indexed = true;
+    }
+    auto it = byName.find(lower(info[0].ToString().Utf8Value()));
+    return it == byName.end() ? nullptr : &it->second;
+  }
+
+  Napi::String joined(Napi::Env env, const std::vector<uint32_t>& idx) {
+    if (idx.size() == 1) {
+      std::string_view v = h->value(idx[0]);
+      return Napi::String::New(env, v.data(), v.size());
+    }
+    std::string out;
+    for (size_t i = 0; i < idx.size(); ++i) {
+      if (i) out += ", ";
+      out += h->value(idx[i]);
+    }
+    return Napi::String::New(env, out);
+  }
+
+  Napi::Value Get(const Napi::CallbackInfo& info) {
+    const std::vector<uint32_t>* idx = find(info);
+    return idx ? (Napi::Value)joined(info.Env(), *idx) : info.Env().Null();
+  }
+
+  Napi::Value Has(const Napi::CallbackInfo& info) { return Napi::Boolean::New(info.Env(), find(info) != nullptr); }
+
+  Napi::Value GetSetCookie(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Array arr = Napi::Array::New(env);
+    uint32_t n = 0;
+    for (size_t i = 0; i < h->size(); ++i) {
+      std::string_view k = h->name(i);
+      if (k.size() != 10 || lower(k) != "set-cookie") continue;
+      std::string_view v = h->value(i);
+      arr.Set(n++, Napi::String::New(env, v.data(), v.size()));
+    }
+    return arr;
+  }
+
+  // Sorted lowercased names with repeated fields combined, except
+  // Set-Cookie, which is listed once per field as fetch does.
+  Napi::Array list(Napi::Env env) {
+    std::vector<std::pair<std::string, uint32_t>> names;
+    names.reserve(h->size());
+    for (uint32_t i = 0; i < h->size(); ++i) names.emplace_back(lower(h->name(i)), i);
+    std::stable_sort(names.begin(), names.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    Napi::Array arr = Napi::Array::New(env);
+    uint32_t n = 0;
+    for (size_t i = 0; i < names.size();) {
+      size_t j = i + 1;
+      while (j < names.size() && names[j].first == names[i].first) ++j;
+      Napi::String key = Napi::String::New(env, names[i].first);
+      std::vector<uint32_t> idx;
+      for (size_t k = i; k < j; ++k) idx.push_back(names[k].second);
+      if (names[i].first == "set-cookie") {
+        for (uint32_t f : idx) arr.Set(n++, entry(env, key, joined(env, { f })));
+      } else {
+        arr.Set(n++, entry(env, key, joined(env, idx)));
+      }
+      i = j;
+    }
+    return arr;
+  }
+
+  static Napi::Array entry(Napi::Env env, Napi::String key, Napi::String value) {
+    Napi::Array pair = Napi::Array::New(env, 2);
+    pair.Set((uint32_t)0, key);
+    pair.Set((uint32_t)1, value);
+    return pair;
+  }
+
+  static Napi::Value iterate(Napi::Array arr) { return arr.Get("values").As<Napi::Function>().Call(arr, {}); }
+
+  Napi::Array column(Napi::Env env, uint32_t c) {
+    Napi::Array all = list(env);
+    Napi::Array arr = Napi::Array::New(env, all.Length());
+    for (uint32_t i = 0; i < all.Length(); ++i) arr.Set(i, all.Get(i).As<Napi::Array>().Get(c));
+    return arr;
+  }
+
+  Napi::Value Entries(const Napi::CallbackInfo& info) { return iterate(list(info.Env())); }
+  Napi::Value Keys(const Napi::CallbackInfo& info) { return iterate(column(info.Env(), 0)); }
+  Napi::Value Values(const Napi::CallbackInfo& info) { return iterate(column(info.Env(), 1)); }
+
+  Napi::Value ForEach(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsFunction()) throw Napi::TypeError::New(env, "forEach expects a function");
+    Napi::Function cb = info[0].As<Napi::Function>();
+    Napi::Value self = info.Length() >= 2 ? info[1] : env.Undefined();
+    Napi::Array all = list(env);
+    for (uint32_t i = 0; i < all.Length(); ++i) {
+      Napi::Array pair = all.Get(i).As<Napi::Array>();
+      cb.Call(self, { pair.Get((uint32_t)1), pair.Get((uint32_t)0), Value() });
+    }
+    return env.Undefined();
+  }
+
+  std::shared_ptr<const HeaderCollector> h{std::make_shared<HeaderCollector>()};
+  std::unordered_map<std::string, std::vector<uint32_t>> byName;
+  bool indexed{false};
+};
+
+// What fetch() resolves to. Methods live on the prototype, and headers,
+// timings and the body stream only become JS values when first read.
+class ImpitResponse : public Napi::ObjectWrap<ImpitResponse> {
+public:
+  static Napi::Function InitClass(Napi::Env env) {
+    return DefineClass(env, "ImpitResponse", {
+      InstanceAccessor<&ImpitResponse::Status>("status"),
+      InstanceAccessor<&ImpitResponse::StatusText>("statusText"),
+      InstanceAccessor<&ImpitResponse::StatusText>("status_text"),
+      InstanceAccessor<&ImpitResponse::HttpVersion>("httpVersion"),
+      InstanceAccessor<&ImpitResponse::Ok>("ok"),
+      InstanceAccessor<&ImpitResponse::Url>("url"),
+      InstanceAccessor<&ImpitResponse::Headers>("headers"),
+      InstanceAccessor<&ImpitResponse::Timings>("timings"),
+      InstanceAccessor<&ImpitResponse::Body>("body"),
+      InstanceAccessor<&ImpitResponse::BodyUsed>("bodyUsed"),
+      InstanceMethod<&ImpitResponse::Text>("text"),
+      InstanceMethod<&ImpitResponse::Json>("json"),
+      InstanceMethod<&ImpitResponse::Bytes>("bytes"),
+      InstanceMethod<&ImpitResponse::ToArrayBuffer>("arrayBuffer"),
+      InstanceMethod<&ImpitResponse::Clone>("clone"),
+      InstanceMethod<&ImpitResponse::Abort>("abort")
+    });
+  }
+
+  ImpitResponse(const Napi::CallbackInfo& info) : Napi::ObjectWrap<ImpitResponse>(info) {}
+
+  // Takes the body and headers over from a finished transfer.
+  static Napi::Object Create(Napi::Env env, Transfer& t) {
+    Napi::Object o = env.GetInstanceData<AddonData>()->responseCtor.New({});
+    ImpitResponse* r = Unwrap(o);
+    r->status = t.status;
+    r->url.swap(t.finalUrl);
+    r->headers = std::make_shared<HeaderCollector>(std::move(t.hc));
+    r->body.swap(t.respBody);
+    r->hasTimings = t.wantTimings;
+    if (t.wantTimings) r->tm = t.tm;
+    return o;
+  }
+
+private:
+  Napi::Value Status(const Napi::CallbackInfo& info) { return Napi::Number::New(info.Env(), status); }
+  Napi::Value StatusText(const Napi::CallbackInfo& info) { return Napi::String::New(info.Env(), headers->reason().data(), headers->reason().size()); }
+  Napi::Value HttpVersion(const Napi::CallbackInfo& info) { return Napi::String::New(info.Env(), headers->version); }
+  Napi::Value Ok(const Napi::CallbackInfo& info) { return Napi::Boolean::New(info.Env(), status >= 200 && status < 300); }
+  Napi::Value Url(const Napi::CallbackInfo& info) { return Napi::String::New(info.Env(), url); }
+  Napi::Value BodyUsed(const Napi::CallbackInfo& info) { return Napi::Boolean::New(info.Env(), used); }
+
+  Napi::Value Headers(const Napi::CallbackInfo& info) {
+    if (headersCache.IsEmpty()) headersCache = Napi::Persistent(ImpitHeaders::Create(info.Env(), headers));
+    return headersCache.Value();
+  }
+
+  Napi::Value Timings(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!hasTimings) return env.Undefined();
+    if (timingsCache.IsEmpty()) timingsCache = Napi::Persistent(timingsToObject(env, tm));
+    return timingsCache.Value();
+  }
+
+  // The stream holds the response through its source, so the cache is weak
+  // to avoid a cycle through a persistent reference.
+  Napi::Value Body(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!stream.IsEmpty() && !stream.Value().IsEmpty()) return stream.Value();
+    Napi::Object source = Napi::Object::New(env);
+    source.Set("response", Value());
+    source.Set("pull", Napi::Function::New(env, [this](const Napi::CallbackInfo& info) {
+      Pull(info.Env(), info[0].As<Napi::Object>());
+      return info.Env().Undefined();
+    }));
+    Napi::Object s = env.Global().Get("ReadableStream").As<Napi::Function>().New({ source });
+    stream = Napi::Weak(s);
+    return s;
+  }
+
+  void Pull(Napi::Env env, Napi::Object controller) {
+    if (aborted) {
+      controller.Get("error").As<Napi::Function>().Call(controller, { abortReason.Value().Get("reason") });
+      return;
+    }
+    if (!used && !body.empty()) controller.Get("enqueue").As<Napi::Function>().Call(controller, { takeBuffer(env) });
+    used = true;
+    controller.Get("close").As<Napi::Function>().Call(controller, {});
+  }
+
+  // Rejects `d` and returns false when the body can no longer be read;
+  // otherwise marks it used.
+  bool consume(Napi::Env env, Napi::Promise::Deferred& d) {
+    if (aborted) {
+      d.Reject(abortError(env).Value());
+      return false;
+    }
+    if (used) {
+      d.Reject(Napi::TypeError::New(env, "Body has already been read").Value());
+      return false;
+    }
+    used = true;
+    return true;
+  }
+
+  // Hands the body to JS without copying it.
+  Napi::Buffer<uint8_t> takeBuffer(Napi::Env env) {
+    auto* owned = new std::string(std::move(body));
+    body.clear();
+    return Napi::Buffer<uint8_t>::New(env, reinterpret_cast<uint8_t*>(&(*owned)[0]), owned->size(), [](Napi::Env, uint8_t*, std::string* s) { delete s; }, owned);
+  }
+
+  Napi::Value Text(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    auto d = Napi::Promise::Deferred::New(env);
+    if (!consume(env, d)) return d.Promise();
+    d.Resolve(Napi::String::New(env, body));
+    std::string().swap(body);
+    return d.Promise();
+  }
+
+  Napi::Value Json(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    auto d = Napi::Promise::Deferred::New(env);
+    if (!consume(env, d)) return d.Promise();
+    Napi::String text = Napi::String::New(env, body);
+    std::string().swap(body);
+    try {
+      d.Resolve(env.Global().Get("JSON").As<Napi::Object>().Get("parse").As<Napi::Function>().Call({ text }));
+    } catch (const Napi::Error& e) {
+      d.Reject(e.Value());
+    }
+    return d.Promise();
+  }
+
+  Napi::Value Bytes(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    auto d = Napi::Promise::Deferred::New(env);
+    if (!consume(env, d)) return d.Promise();
+    d.Resolve(takeBuffer(env));
+    return d.Promise();
+  }
+
+  Napi::Value ToArrayBuffer(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    auto d = Napi::Promise::Deferred::New(env);
+    if (!consume(env, d)) return d.Promise();
+    auto* owned = new std::string(std::move(body));
+    body.clear();
+    d.Resolve(Napi::ArrayBuffer::New(env, &(*owned)[0], owned->size(), [](Napi::Env, void*, std::string* s) { delete s; }, owned));
+    return d.Promise();
+  }
+
+  Napi::Value Clone(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (used || aborted) throw Napi::TypeError::New(env, "Body has already been read");
+    Napi::Object o = env.GetInstanceData<AddonData>()->responseCtor.New({});
+    ImpitResponse* r = Unwrap(o);
+    r->status = status;
+    r->url = url;
+    r->headers = headers;
+    r->body = body;
+    r->hasTimings = hasTimings;
+    r->tm = tm;
+    return o;
+  }
+
+  // Drops the buffered body. A body stream that has not been read yet
+  // errors with `reason` on its next read.
+  Napi::Value Abort(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (aborted || used) return env.Undefined();
+    aborted = true;
+    std::string().swap(body);
+    // Boxed: references to primitives need a newer N-API.
+    Napi::Object box = Napi::Object::New(env);
+    box.Set("reason", info.Length() >= 1 && !info[0].IsUndefined() ? info[0] : abortError(env).Value());
+    abortReason = Napi::Persistent(box);
+    return env.Undefined();
+  }
+
+  long status{0};
+  std::string url;
+  std::shared_ptr<const HeaderCollector> headers{std::make_shared<HeaderCollector>()};
+  std::string body;
+  TransferTimings tm;
+  bool hasTimings{false};
+  bool used{false};
+  bool aborted{false};
+  Napi::ObjectReference abortReason;
+  Napi::ObjectReference headersCache;
+  Napi::ObjectReference timingsCache;
+  Napi::ObjectReference stream;
+};
+
+// Per-request options frozen by compileProfile(), with the header and
+// resolve lists already built. fetch(url, profile) uses it as is.
+class ImpitProfile : public Napi::ObjectWrap<ImpitProfile> {
+public:
+  static Napi::Function InitClass(Napi::Env env) {
+    return DefineClass(env, "ImpitProfile", {});
+  }
+
+  ImpitProfile(const Napi::CallbackInfo& info) : Napi::ObjectWrap<ImpitProfile>(info) {}
+
+  static Napi::Object Create(Napi::Env env, const void* owner, RequestSpec&& spec) {
+    Napi::Object o = env.GetInstanceData<AddonData>()->profileCtor.New({});
+    ImpitProfile* p = Unwrap(o);
+    p->owner = owner;
+    p->spec = std::move(spec);
+    return o;
+  }
+
+  static ImpitProfile* From(Napi::Env env, Napi::Object o) {
+    return o.InstanceOf(env.GetInstanceData<AddonData>()->profileCtor.Value()) ? Unwrap(o) : nullptr;
+  }
+
+  // The client that compiled it; only compared, never dereferenced.
+  const void* owner{nullptr};
+  RequestSpec spec;
+};
+
+class ImpitWrapper;
+
+// What session() returns: a copy of the parent's defaults with the session's
+// overrides applied, and a cookie store of its own. Requests run on the
+// parent's engine, so connections, DNS and TLS sessions are shared.
+class ImpitSession : public Napi::ObjectWrap<ImpitSession> {
+public:
+  static Napi::Function InitClass(Napi::Env env) {
+    return DefineClass(env, "ImpitSession", {
+      InstanceMethod<&ImpitSession::Fetch>("fetch"),
+      InstanceMethod<&ImpitSession::GetCookies>("getCookies"),
+      InstanceMethod<&ImpitSession::SetCookies>("setCookies")
+    });
+  }
+
+  ImpitSession(const Napi::CallbackInfo& info) : Napi::ObjectWrap<ImpitSession>(info) {}
+
+  static ImpitSession* Create(Napi::Env env, Napi::Object& out) {
+    out = env.GetInstanceData<AddonData>()->sessionCtor.New({});
+    return Unwrap(out);
+  }
+
+  static void readCookies(Napi::Value v, std::vector<std::string>& out) {
+    Napi::Array arr = v.As<Napi::Array>();
+    out.clear();
+    for (uint32_t i = 0; i < arr.Length(); ++i) {
+      if (arr.Get(i).IsString()) out.push_back(arr.Get(i).As<Napi::String>().Utf8Value());
+    }
+  }
+
+  Napi::Value Fetch(const Napi::CallbackInfo& info);
+
+  Napi::Value GetCookies(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Array arr = Napi::Array::New(env, cookies->size());
+    for (size_t i = 0; i < cookies->size(); ++i) arr.Set(i, Napi::String::New(env, (*cookies)[i]));
+    return arr;
+  }
+
+  Napi::Value SetCookies(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsArray()) throw Napi::Error::New(env, "Expected an array of strings");
+    readCookies(info[0], *cookies);
+    return env.Undefined();
+  }
+
+  ImpitWrapper* parent{nullptr};
+  // Keeps the parent, and with it the engine, alive.
+  Napi::ObjectReference parentRef;
+  // A full copy of the client's defaults with the session's options
+  // applied, not a diff: a few hundred bytes plus whatever strings it holds.
+  RequestSpec spec;
+  std::shared_ptr<std::vector<std::string>> cookies{std::make_shared<std::vector<std::string>>()};
+};
+
+// The share is touched from the JS thread (handle setup and cleanup), the
+// engine thread and job runners, so libcurl needs it locked.
+static void share_lock_cb(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+  static_cast<std::mutex*>(userptr)[data].lock();
+}
+
+static void share_unlock_cb(CURL*, curl_lock_data data, void* userptr) {
+  static_cast<std::mutex*>(userptr)[data].unlock();
+}
+
+class ImpitWrapper : public Napi::ObjectWrap<ImpitWrapper> {
+public:
+  static Napi::Function InitClass(Napi::Env env) {
+    return DefineClass(env, "Impit", {
+      InstanceMethod<&ImpitWrapper::Fetch>("fetch"),
+      InstanceMethod<&ImpitWrapper::FetchMany>("fetchMany"),
+      InstanceMethod<&ImpitWrapper::RunJobFile>("runJobFile"),
+      InstanceMethod<&ImpitWrapper::CompileProfile>("compileProfile"),
+      InstanceMethod<&ImpitWrapper::Session>("session"),
+      InstanceMethod<&ImpitWrapper::GetCookies>("getCookies"),
+      InstanceMethod<&ImpitWrapper::SetCookies>("setCookies"),
+      InstanceMethod<&ImpitWrapper::ProxyStats>("proxyStats"),
+      InstanceMethod<&ImpitWrapper::Metrics>("metrics"),
+      InstanceMethod<&ImpitWrapper::DrainTrace>("drainTrace"),
+      InstanceMethod<&ImpitWrapper::DumpTrace>("dumpTrace"),
+      InstanceMethod<&ImpitWrapper::Inflight>("inflight"),
+      InstanceMethod<&ImpitWrapper::Cancel>("cancel"),
+      InstanceMethod<&ImpitWrapper::CancelWhere>("cancelWhere"),
+      InstanceMethod<&ImpitWrapper::Group>("group"),
+      InstanceMethod<&ImpitWrapper::AdaptiveLimits>("adaptiveLimits"),
+      InstanceMethod<&ImpitWrapper::BreakerStats>("breakerStats")
+    });
+  }
+
+  ImpitWrapper(const Napi::CallbackInfo& info) : Napi::ObjectWrap<ImpitWrapper>(info) {
+    Napi::Env env = info.Env();
+    defaults.timeoutMs = 30000;
+    defaults.dohUrl = "https://cloudflare-dns.com/dns-query";
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Value err;
+      if (!ParseOptions(env, info[0].As<Napi::Object>(), kScopeClient, defaults, {}, err)) throw Napi::Error(env, err);
+    }
+    if (verbose) traceRing.reset(new TraceRing(traceBufferSize));
+    curl_slist* list = nullptr;
+    for (auto& kv : defaultHeaders) appendHeader(list, kv.first, kv.second, defaults.userAgent, defaults.referer);
+    if (list) defaultSlist.reset(list, curl_slist_free_all);
+    // Keep connections, DNS and TLS sessions alive across fetches so a
+    // rotating proxy pool does not cost a fresh handshake per request.
+    share = curl_share_init();
+    if (share) {
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+      curl_share_setopt(share, CURLSHOPT_USERDATA, shareLocks);
+      curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+      curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+    }
+    // Only referenced while requests are in flight, so an idle client never
+    // holds the event loop open.
+    settleFn = Napi::ThreadSafeFunction::New(env, Napi::Function::New(env, [](const Napi::CallbackInfo&){}), "impit", 0, 1);
+    settleFn.Unref(env);
+    Engine::Hooks hooks;
+    hooks.retry = [this](Transfer* t) { return RetryTransfer(t); };
+    hooks.finish = [this](Transfer* t) { FinishTransfer(t); };
+    hooks.hedge = [this](Transfer* t) { return HedgeTransfer(t); };
+    hooks.discard = [this](Transfer* x) { DiscardTransfer(x); };
+    hooks.notify = [this]() {
+      settleFn.NonBlockingCall([this](Napi::Env env, Napi::Function) { SettleTransfers(env); });
+    };
+    engine.start(std::move(hooks));
+  }
+
+  ~ImpitWrapper() {
+    for (auto& job : jobs) {
+      job->doneFn.Abort();
+      job->stop(true);
+      if (job->thread.joinable()) job->thread.join();
+    }
+    engine.stop();
+    settleFn.Abort();
+    if (share) curl_share_cleanup(share);
+  }
+
+  // fetch(url, init) returns a promise. fetch(url, init, callback) is the
+  // promise-free form: it returns the request id, calls callback(err, res)
+  // from the settle batch, and throws errors found before submission.
+  Napi::Value Fetch(const Napi::CallbackInfo& info) { return FetchFor(info, nullptr); }
+
+  // Fetch on behalf of a session, or of the client itself when null.
+  Napi::Value FetchFor(const Napi::CallbackInfo& info, ImpitSession* session) {
+    Napi::Env env = info.Env();
+    bool callback = info.Length() >= 3 && info[2].IsFunction();
+    std::unique_ptr<Transfer> t(callback ? new Transfer() : new Transfer(env));
+    auto fail = [&](Napi::Value e) -> Napi::Value {
+      if (callback) throw Napi::Error(env, e);
+      t->deferred->Reject(e);
+      return t->deferred->Promise();
+    };
+    if (info.Length() < 1) return fail(Napi::Error::New(env, "url required").Value());
+    t->url = info[0].As<Napi::String>().Utf8Value();
+    RequestSpec spec;
+    const RequestSpec* use = &spec;
+    Napi::Value err;
+    ImpitProfile* profile = info.Length() >= 2 && info[1].IsObject() ? ImpitProfile::From(env, info[1].As<Napi::Object>()) : nullptr;
+    if (profile) {
+      if (profile->owner != this) return fail(Napi::TypeError::New(env, "Profile was compiled by another client").Value());
+      if (session) return fail(Napi::TypeError::New(env, "Profiles cannot be used through a session").Value());
+      use = &profile->spec;
+    } else if (info.Length() >= 2 && info[1].IsObject()) {
+      spec = session ? session->spec : DefaultSpec();
+      Napi::Object init = info[1].As<Napi::Object>();
+      if (init.Has("signal") && init.Get("signal").IsObject()) {
+        Napi::Object signal = init.Get("signal").As<Napi::Object>();
+        if (signal.Get("aborted").ToBoolean().Value()) return fail(signal.Get("reason"));
+        t->signal = Napi::Persistent(signal);
+      }
+      if (!ParseInit(env, init, spec, err)) return fail(err);
+    } else {
+      use = session ? &session->spec : &defaults;
+    }
+    BuildError be;
+    if (session) t->jar = session->cookies;
+    if (!BuildTransfer(*t, *use, session ? *session->cookies : cookieJar, be)) return fail(buildError(env, be));
+    WatchSignal(env, *t);
+    Napi::Value result;
+    if (callback) {
+      t->callback = Napi::Persistent(info[2].As<Napi::Function>());
+      result = Napi::Number::New(env, (double)t->id);
+    } else {
+      result = t->deferred->Promise();
+    }
+    Track(env, 1);
+    engine.submit(t.release());
+    return result;
+  }
+
+  // compileProfile(init) validates an init once, signal aside, and freezes
+  // it with its header and resolve lists built. Passing the profile as
+  // fetch()'s init skips option parsing entirely.
+  Napi::Value CompileProfile(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    RequestSpec spec = DefaultSpec();
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Object init = info[0].As<Napi::Object>();
+      if (init.Has("signal") && !init.Get("signal").IsUndefined()) {
+        throw Napi::TypeError::New(env, "A profile cannot hold a signal");
+      }
+      Napi::Value err;
+      if (!ParseInit(env, init, spec, err)) throw Napi::Error(env, err);
+    }
+    std::transform(spec.method.begin(), spec.method.end(), spec.method.begin(), ::toupper);
+    if ((spec.method == "GET" || spec.method == "HEAD") && spec.hasBody) {
+      throw Napi::TypeError::New(env, "GET/HEAD methods don't support passing a request body");
+    }
+    if (!spec.proxy.empty()) spec.proxy = ensureProxyScheme(spec.proxy);
+    if (curl_slist* own = headerList(spec, spec.headerList)) spec.headerList.reset(own, curl_slist_free_all);
+    if (!spec.dohUrl.empty()) {
+      if (curl_slist* list = buildResolveList(spec)) spec.resolveList.reset(list, curl_slist_free_all);
+    }
+    return ImpitProfile::Create(env, this, std::move(spec));
+  }
+
+  // session(options) derives a lightweight identity: request options such
+  // as proxy, headers and userAgent over the client's, plus its own
+  // `cookies`. The lists it needs are built once here.
+  Napi::Value Session(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Object out;
+    ImpitSession* session = ImpitSession::Create(env, out);
+    session->parent = this;
+    session->parentRef = Napi::Persistent(Value());
+    RequestSpec& spec = session->spec = DefaultSpec();
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Object o = info[0].As<Napi::Object>();
+      Napi::Value err;
+      if (!ParseOptions(env, o, kScopeSession, spec, { "cookies" }, err)) throw Napi::Error(env, err);
+      Napi::Value c = o.Get("cookies");
+      if (c.IsArray()) ImpitSession::readCookies(c, *session->cookies);
+      else if (!c.IsUndefined() && !c.IsNull()) throw Napi::TypeError::New(env, "Option 'cookies' must be an array");
+    }
+    if (!spec.proxy.empty()) spec.proxy = ensureProxyScheme(spec.proxy);
+    if (curl_slist* own = headerList(spec, spec.headerList)) spec.headerList.reset(own, curl_slist_free_all);
+    if (!spec.dohUrl.empty()) {
+      if (curl_slist* list = buildResolveList(spec)) spec.resolveList.reset(list, curl_slist_free_all);
+    }
+    return out;
+  }
+
+  // fetchMany(requests, options) takes URLs or { url, method, headers, body }
+  // descriptors and returns an async iterator of { index, response | error }
+  // in completion order. The options are parsed once for the whole batch,
+  // which runs as its own group so `concurrency` is enforced by the engine.
+  Napi::Value FetchMany(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsArray()) {
+      throw Napi::TypeError::New(env, "Expected an array of requests");
+    }
+    Napi::Array list = info[0].As<Napi::Array>();
+    RequestSpec base = DefaultSpec();
+    auto batch = std::make_shared<Batch>();
+    auto g = std::make_shared<RequestGroup>();
+    g->id = ++nextGroupId;
+    if (info.Length() >= 2 && info[1].IsObject()) {
+      Napi::Object o = info[1].As<Napi::Object>();
+      Napi::Value err;
+      if (!ParseInit(env, o, base, err, { "concurrency" })) throw Napi::Error(env, err);
+      if (o.Has("concurrency") && o.Get("concurrency").IsNumber()) g->maxConcurrency = o.Get("concurrency").As<Napi::Number>().Uint32Value();
+      if (o.Has("signal") && o.Get("signal").IsObject()) {
+        Napi::Object signal = o.Get("signal").As<Napi::Object>();
+        if (signal.Get("aborted").ToBoolean().Value()) throw Napi::Error(env, signal.Get("reason"));
+        batch->signal = Napi::Persistent(signal);
+      }
+    }
+    base.group = g;
+    batch->group = g;
+    uint32_t n = list.Length();
+    batch->remaining = n;
+    std::vector<Transfer*> built;
+    built.reserve(n);
+    for (uint32_t i = 0; i < n; ++i) {
+      Napi::Value item = list.Get(i);
+      std::unique_ptr<Transfer> t(new Transfer());
+      t->batch = batch;
+      t->index = i;
+      BuildError be;
+      bool ok;
+      Napi::Value url = item.IsObject() ? item.As<Napi::Object>().Get("url") : item;
+      if (!url.IsString()) {
+        Deliver(env, *t, Napi::TypeError::New(env, item.IsObject() ? "Request descriptor needs a string 'url'" : "Invalid request descriptor").Value(), false);
+        continue;
+      }
+      t->url = url.As<Napi::String>().Utf8Value();
+      if (item.IsString()) {
+        ok = BuildTransfer(*t, base, cookieJar, be);
+      } else {
+        Napi::Object d = item.As<Napi::Object>();
+        RequestSpec spec = base;
+        if (d.Has("method") && d.Get("method").IsString()) spec.method = d.Get("method").As<Napi::String>().Utf8Value();
+        if (d.Has("headers")) readHeaders(d.Get("headers"), spec.headers);
+        if (d.Has("body")) readBody(d.Get("body"), spec);
+        ok = BuildTransfer(*t, spec, cookieJar, be);
+      }
+      if (ok) built.push_back(t.release());
+      else Deliver(env, *t, buildError(env, be), false);
+    }
+    if (!built.empty()) {
+      if (!batch->signal.IsEmpty()) {
+        Napi::Object signal = batch->signal.Value();
+        Napi::Function onAbort = Napi::Function::New(env, [this, g](const Napi::CallbackInfo& info) {
+          engine.cancelGroup(g, "cancelled");
+          return info.Env().Undefined();
+        });
+        Napi::Object opts = Napi::Object::New(env);
+        opts.Set("once", Napi::Boolean::New(env, true));
+        signal.Get("addEventListener").As<Napi::Function>().Call(signal, { Napi::String::New(env, "abort"), onAbort, opts });
+        batch->onAbort = Napi::Persistent(onAbort);
+      }
+      Track(env, (uint32_t)built.size());
+      engine.submit(built);
+    }
+
+    Napi::Object iter = Napi::Object::New(env);
+    iter.Set("next", Napi::Function::New(env, [batch](const Napi::CallbackInfo& info) {
+      Napi::Env env = info.Env();
+      auto d = Napi::Promise::Deferred::New(env);
+      if (!batch->ready.empty()) {
+        Napi::Object item = batch->ready.front().Value();
+        batch->ready.pop_front();
+        d.Resolve(iterResult(env, item, false));
+      } else if (batch->remaining == 0 || batch->closed) {
+        d.Resolve(iterResult(env, env.Undefined(), true));
+      } else {
+        batch->waiters.push_back(d);
+      }
+      return d.Promise();
+    }));
+    // Breaking out of for-await cancels whatever has not finished yet.
+    iter.Set("return", Napi::Function::New(env, [this, batch](const Napi::CallbackInfo& info) {
+      Napi::Env env = info.Env();
+      if (!batch->closed) {
+        batch->closed = true;
+        batch->ready.clear();
+        if (batch->remaining) engine.cancelGroup(batch->group, "cancelled");
+        for (auto& w : batch->waiters) w.Resolve(iterResult(env, env.Undefined(), true));
+        batch->waiters.clear();
+      }
+      auto d = Napi::Promise::Deferred::New(env);
+      d.Resolve(iterResult(env, info.Length() >= 1 ? info[0] : env.Undefined(), true));
+      return d.Promise();
+    }));
+    iter.Set(Napi::Symbol::WellKnown(env, "asyncIterator"), Napi::Function::New(env, [](const Napi::CallbackInfo& info) {
+      return info.This();
+    }));
+    return iter;
+  }
+
+  // runJobFile(inPath, outPath, options) runs the NDJSON descriptors of
+  // inPath from a native thread and appends one result line per request to
+  // outPath. Progress is checkpointed to outPath + ".checkpoint", so running
+  // the same job again resumes where the last run stopped.
+  Napi::Value RunJobFile(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsString()) {
+      throw Napi::TypeError::New(env, "Expected input and output paths");
+    }
+    auto job = std::make_shared<JobRun>();
+    job->inPath = info[0].As<Napi::String>().Utf8Value();
+    job->outPath = info[1].As<Napi::String>().Utf8Value();
+    job->base = DefaultSpec();
+    job->base.timings = true;
+    if (info.Length() >= 3 && info[2].IsObject()) {
+      Napi::Object o = info[2].As<Napi::Object>();
+      Napi::Value err;
+      if (!ParseInit(env, o, job->base, err, { "concurrency", "body", "bodyDir" })) throw Napi::Error(env, err);
+      if (o.Has("concurrency") && o.Get("concurrency").IsNumber()) job->concurrency = std::max(1u, o.Get("concurrency").As<Napi::Number>().Uint32Value());
+      if (o.Has("body") && o.Get("body").IsString()) {
+        std::string mode = o.Get("body").As<Napi::String>().Utf8Value();
+        job->bodyMode = mode == "file" ? JobRun::kBodyFile : mode == "hash" ? JobRun::kBodyHash : mode == "none" ? JobRun::kBodyNone : JobRun::kBodyInline;
+      }
+      if (o.Has("bodyDir") && o.Get("bodyDir").IsString()) job->bodyDir = o.Get("bodyDir").As<Napi::String>().Utf8Value();
+      if (o.Has("signal") && o.Get("signal").IsObject()) {
+        Napi::Object signal = o.Get("signal").As<Napi::Object>();
+        if (signal.Get("aborted").ToBoolean().Value()) throw Napi::Error(env, signal.Get("reason"));
+        job->signal = Napi::Persistent(signal);
+      }
+    }
+    if (job->bodyMode == JobRun::kBodyFile && job->bodyDir.empty()) job->bodyDir = job->outPath + ".bodies";
+    job->cookies = cookieJar;
+    if (!job->base.group) {
+      job->base.group = std::make_shared<RequestGroup>();
+      job->base.group->id = ++nextGroupId;
+    }
+    job->group = job->base.group;
+    job->deferred = Napi::Promise::Deferred::New(env);
+    job->doneFn = Napi::ThreadSafeFunction::New(env, Napi::Function::New(env, [](const Napi::CallbackInfo&){}), "impit-job", 0, 1);
+    if (!job->signal.IsEmpty()) {
+      std::weak_ptr<JobRun> weak = job;
+      Napi::Object signal = job->signal.Value();
+      Napi::Function onAbort = Napi::Function::New(env, [this, weak](const Napi::CallbackInfo& info) {
+        if (auto job = weak.lock()) {
+          job->stop(false);
+          engine.cancelGroup(job->group, "cancelled");
+        }
+        return info.Env().Undefined();
+      });
+      Napi::Object opts = Napi::Object::New(env);
+      opts.Set("once", Napi::Boolean::New(env, true));
+      signal.Get("addEventListener").As<Napi::Function>().Call(signal, { Napi::String::New(env, "abort"), onAbort, opts });
+      job->onAbort = Napi::Persistent(onAbort);
+    }
+    jobs.insert(job);
+    Ref();
+    Napi::Promise promise = job->deferred->Promise();
+    job->thread = std::thread([this, job] {
+      RunJob(*job);
+      job->doneFn.BlockingCall([this, job](Napi::Env env, Napi::Function) { FinishJob(env, job); });
+      job->doneFn.Release();
+    });
+    return promise;
+  }
+
+  void FinishJob(Napi::Env env, std::shared_ptr<JobRun> job) {
+    job->thread.join();
+    jobs.erase(job);
+    if (!job->signal.IsEmpty()) {
+      Napi::Object signal = job->signal.Value();
+      signal.Get("removeEventListener").As<Napi::Function>().Call(signal, { Napi::String::New(env, "abort"), job->onAbort.Value() });
+    }
+    if (!job->error.empty()) {
+      job->deferred->Reject(Napi::Error::New(env, job->error).Value());
+    } else {
+      Napi::Object o = Napi::Object::New(env);
+      o.Set("succeeded", Napi::Number::New(env, (double)job->succeeded));
+      o.Set("failed", Napi::Number::New(env, (double)job->failed));
+      o.Set("skipped", Napi::Number::New(env, (double)job->skipped));
+      o.Set("resumedAt", Napi::Number::New(env, (double)job->resumedAt));
+      o.Set("complete", Napi::Boolean::New(env, job->complete));
+      job->deferred->Resolve(o);
+    }
+    Unref();
+  }
+
+  // A descriptor line: a URL string, or { url, method, headers, body,
+  // timeout, sessionId, proxy, id } over the job's shared options.
+  static bool parseJobLine(const std::string& line, RequestSpec& spec, std::string& url, std::string& idJson, std::string& err) {
+    JsonValue v;
+    if (!JsonReader(line).parse(v)) {
+      err = "Invalid JSON";
+      return false;
+    }
+    if (v.type == JsonValue::kString) {
+      url = v.str;
+      return true;
+    }
+    if (v.type != JsonValue::kObject) {
+      err = "Invalid request descriptor";
+      return false;
+    }
+    if (const JsonValue* id = v.get("id")) writeJson(idJson, *id);
+    const JsonValue* u = v.get("url");
+    if (!u || u->type != JsonValue::kString) {
+      err = "Missing url";
+      return false;
+    }
+    url = u->str;
+    if (const JsonValue* m = v.get("method")) {
+      if (m->type == JsonValue::kString) spec.method = m->str;
+    }
+    if (const JsonValue* h = v.get("headers")) {
+      for (size_t i = 0; i < h->items.size(); ++i) {
+        const JsonValue& item = h->items[i];
+        std::string k, val;
+        if (h->type == JsonValue::kObject && item.type == JsonValue::kString) {
+          k = h->keys[i];
+          val = item.str;
+        } else if (h->type == JsonValue::kArray && item.type == JsonValue::kArray && item.items.size() >= 2 && item.items[0].type == JsonValue::kString && item.items[1].type == JsonValue::kString) {
+          k = item.items[0].str;
+          val = item.items[1].str;
+        } else {
+          continue;
+        }
+        if (sanitizeHeaderKV(k, val)) spec.headers.emplace_back(k, val);
+      }
+    }
+    if (const JsonValue* b = v.get("body")) {
+      if (b->type == JsonValue::kString) {
+        spec.body = b->str;
+        spec.hasBody = true;
+      }
+    }
+    if (const JsonValue* t = v.get("timeout")) {
+      if (t->type == JsonValue::kNumber) spec.timeoutMs = (uint32_t)t->number;
+    }
+    if (const JsonValue* sid = v.get("sessionId")) {
+      if (sid->type == JsonValue::kString) spec.sessionId = sid->str;
+    }
+    if (const JsonValue* px = v.get("proxy")) {
+      if (px->type == JsonValue::kString) spec.proxy = px->str;
+    }
+    return true;
+  }
 
-struct WriteData {
-  std::string* body;
-  StreamCtx* stream;
-};
+  static void jobError(std::string& out, uint64_t line, const std::string& idJson, const std::string& url, const std::string& message, CURLcode rc, const char* phase) {
+    out += "{\"line\":" + std::to_string(line);
+    if (!idJson.empty()) out += ",\"id\":" + idJson;
+    out += ",\"url\":";
+    jsonString(out, url);
+    out += ",\"error\":{\"message\":";
+    jsonString(out, message);
+    if (rc != CURLE_OK) out += ",\"curlCode\":" + std::to_string((int)rc);
+    if (phase) {
+      out += ",\"phase\":";
+      jsonString(out, phase, strlen(phase));
+    }
+    out += "}}\n";
+  }
 
-static size_t write_stream_cb(char* ptr, size_t size, size_t nmemb, void* userdata) {
-  WriteData* wd = reinterpret_cast<WriteData*>(userdata);
-  size_t len = size * nmemb;
-  wd->body->append(ptr, len);
-  if (wd->stream) {
-    Napi::Env env = wd->stream->env;
-    Napi::Buffer<uint8_t> buf = Napi::Buffer<uint8_t>::Copy(env, reinterpret_cast<const uint8_t*>(ptr), len);
-    wd->stream->enqueue.Value().Call({ buf });
+  static void jobResult(JobRun& j, std::string& out, uint64_t line, const std::string& idJson, const Transfer& t) {
+    out += "{\"line\":" + std::to_string(line);
+    if (!idJson.empty()) out += ",\"id\":" + idJson;
+    out += ",\"url\":";
+    jsonString(out, t.url);
+    out += ",\"finalUrl\":";
+    jsonString(out, t.finalUrl);
+    out += ",\"status\":" + std::to_string(t.status);
+    out += ",\"statusText\":";
+    jsonString(out, t.hc.reason().data(), t.hc.reason().size());
+    out += ",\"headers\":[";
+    for (size_t i = 0; i < t.hc.size(); ++i) {
+      std::string_view k = t.hc.name(i), v = t.hc.value(i);
+      if (i) out.push_back(',');
+      out.push_back('[');
+      jsonString(out, k.data(), k.size());
+      out.push_back(',');
+      jsonString(out, v.data(), v.size());
+      out.push_back(']');
+    }
+    out += "]";
+    if (t.wantTimings) {
+      out += ",\"timings\":";
+      timingsJson(out, t.tm);
+    }
+    const std::string& body = t.respBody;
+    out += ",\"bodySize\":" + std::to_string(body.size());
+    if (j.bodyMode == JobRun::kBodyFile || j.bodyMode == JobRun::kBodyHash) {
+      out += ",\"bodyHash\":\"fnv1a64:" + fnv1a64(body) + "\"";
+    }
+    if (j.bodyMode == JobRun::kBodyFile) {
+      std::string path = j.bodyDir + "/" + std::to_string(line) + ".body";
+      std::ofstream f(path, std::ios::binary | std::ios::trunc);
+      f.write(body.data(), (std::streamsize)body.size());
+      out += ",\"bodyPath\":";
+      jsonString(out, path);
+    } else if (j.bodyMode == JobRun::kBodyInline) {
+      if (validUtf8(body)) {
+        out += ",\"body\":";
+        jsonString(out, body);
+      } else {
+        out += ",\"bodyEncoding\":\"base64\",\"body\":\"" + base64(body) + "\"";
+      }
+    }
+    out += "}\n";
   }
-  return size * nmemb;
-}
 
-static size_t header_cb(char* buffer, size_t size, size_t nitems, void* userdata) {
-  size_t len = size * nitems;
-  std::string line(buffer, len);
-  // Skip status line
-  if (line.rfind("HTTP/", 0) == 0) return len;
-  auto pos = line.find(':');
-  if (pos != std::string::npos) {
-    std::string key = line.substr(0, pos);
-    std::string val = line.substr(pos + 1);
-    trim(key);
-    val.erase(val.begin(), std::find_if(val.begin(), val.end(), [](unsigned char ch){ return !std::isspace(ch); }));
-    while (!val.empty() && (val.back()=='\r' || val.back()=='\n')) val.pop_back();
-    ((HeaderCollector*)userdata)->headers.emplace_back(key, val);
+  // Runner thread. Results are appended as they finish, so a line further
+  // down the file can be written before an earlier one. The checkpoint
+  // records the oldest line still running and the output size when it was
+  // submitted: everything before that line is done, and anything after it
+  // that is done has a result past that output offset.
+  void RunJob(JobRun& j) {
+    namespace fs = std::filesystem;
+    std::string ckptPath = j.outPath + ".checkpoint";
+    uint64_t nextLine = 1, offset = 0, outMark = 0;
+    {
+      std::ifstream ck(ckptPath, std::ios::binary);
+      std::string text;
+      JsonValue v;
+      if (ck && std::getline(ck, text) && JsonReader(text).parse(v) && v.type == JsonValue::kObject) {
+        const JsonValue* l = v.get("line");
+        const JsonValue* o = v.get("offset");
+        const JsonValue* m = v.get("out");
+        if (l && o && m) {
+          nextLine = (uint64_t)l->number;
+          offset = (uint64_t)o->number;
+          outMark = (uint64_t)m->number;
+        }
+      }
+    }
+    std::error_code ec;
+    uint64_t outSize = fs::exists(j.outPath, ec) ? fs::file_size(j.outPath, ec) : 0;
+    if (outMark > outSize) {
+      // The output was replaced since the checkpoint; start over.
+      nextLine = 1;
+      offset = 0;
+      outMark = 0;
+    }
+    // Results written after the checkpoint, minus a line torn by a crash.
+    std::set<uint64_t> already;
+    {
+      std::ifstream prev(j.outPath, std::ios::binary);
+      prev.seekg((std::streamoff)outMark);
+      uint64_t good = outMark;
+      std::string l;
+      while (prev && std::getline(prev, l)) {
+        if (prev.eof()) break;
+        good += l.size() + 1;
+        if (l.compare(0, 8, "{\"line\":") == 0) already.insert(strtoull(l.c_str() + 8, nullptr, 10));
+      }
+      if (good < outSize) {
+        fs::resize_file(j.outPath, good, ec);
+        outSize = good;
+      }
+    }
+    j.resumedAt = nextLine;
+    std::ifstream in(j.inPath, std::ios::binary);
+    if (!in) {
+      j.error = "Cannot open " + j.inPath;
+      return;
+    }
+    in.seekg((std::streamoff)offset);
+    if (j.bodyMode == JobRun::kBodyFile) fs::create_directories(j.bodyDir, ec);
+    std::ofstream out(j.outPath, std::ios::binary | std::ios::app);
+    if (!out) {
+      j.error = "Cannot open " + j.outPath;
+      return;
+    }
+
+    struct Pending {
+      uint64_t line;
+      std::string idJson;
+    };
+    // Input offset and output size at submission, per line still running.
+    std::map<uint64_t, std::pair<uint64_t, uint64_t>> open;
+    std::unordered_map<uint64_t, Pending> byId;
+    uint64_t pos = offset;
+    bool eof = false;
+    int64_t lastCheckpoint = nowMs();
+    std::string buf;
+    auto write = [&](const std::string& text) {
+      out.write(text.data(), (std::streamsize)text.size());
+      outSize += text.size();
+    };
+    auto checkpoint = [&] {
+      out.flush();
+      uint64_t line = nextLine, at = pos, mark = outSize;
+      if (!open.empty()) {
+        line = open.begin()->first;
+        at = open.begin()->second.first;
+        mark = open.begin()->second.second;
+      }
+      std::string tmp = ckptPath + ".tmp";
+      {
+        std::ofstream ck(tmp, std::ios::binary | std::ios::trunc);
+        ck << "{\"line\":" << line << ",\"offset\":" << at << ",\"out\":" << mark << "}\n";
+      }
+      fs::rename(tmp, ckptPath, ec);
+      lastCheckpoint = nowMs();
+    };
+
+    for (;;) {
+      std::vector<Transfer*> submit;
+      {
+        std::lock_guard<std::mutex> lock(j.mu);
+        if (j.abandon) break;
+        if (j.stopping) eof = true;
+      }
+      while (!eof && byId.size() + submit.size() < j.concurrency) {
+        uint64_t start = pos;
+        std::string line;
+        if (!std::getline(in, line)) {
+          eof = true;
+          break;
+        }
+        pos += line.size() + (in.eof() ? 0 : 1);
+        uint64_t n = nextLine++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.find_first_not_of(" \t") == std::string::npos) continue;
+        if (already.erase(n)) {
+          j.skipped++;
+          continue;
+        }
+        RequestSpec spec = j.base;
+        std::unique_ptr<Transfer> t(new Transfer());
+        std::string idJson, err;
+        BuildError be;
+        if (!parseJobLine(line, spec, t->url, idJson, err) || !BuildTransfer(*t, spec, j.cookies, be)) {
+          buf.clear();
+          jobError(buf, n, idJson, t->url, err.empty() ? (be.key.empty() ? be.message : "Circuit open for " + be.key) : err, CURLE_OK, nullptr);
+          write(buf);
+          j.failed++;
+          continue;
+        }
+        t->sink = &j;
+        open[n] = { start, outSize };
+        byId[t->id] = Pending{ n, std::move(idJson) };
+        submit.push_back(t.release());
+      }
+      if (!submit.empty()) engine.submit(submit);
+      if (byId.empty() && eof) break;
+
+      std::vector<Transfer*> ready;
+      bool stopping;
+      {
+        std::unique_lock<std::mutex> lock(j.mu);
+        j.cv.wait_for(lock, std::chrono::seconds(1), [&] { return !j.finished.empty() || j.abandon; });
+        if (j.abandon) break;
+        ready.swap(j.finished);
+        stopping = j.stopping;
+      }
+      for (Transfer* raw : ready) {
+        std::unique_ptr<Transfer> t(raw);
+        auto it = byId.find(t->id);
+        Pending p = std::move(it->second);
+        byId.erase(it);
+        // Requests cut short by a stop are left for the next run.
+        if (t->cancelled && stopping) continue;
+        open.erase(p.line);
+        buf.clear();
+        if (t->rc == CURLE_OK) {
+          jobResult(j, buf, p.line, p.idJson, *t);
+          j.succeeded++;
+        } else {
+          const char* phase;
+          std::string msg = transferMessage(t->rc, t->errbuf, t->watch, phase);
+          jobError(buf, p.line, p.idJson, t->url, msg, t->rc, phase);
+          j.failed++;
+        }
+        write(buf);
+      }
+      if (nowMs() - lastCheckpoint >= 1000) checkpoint();
+    }
+    checkpoint();
+    std::lock_guard<std::mutex> lock(j.mu);
+    j.complete = !j.stopping && open.empty() && eof;
   }
-  return len;
-}
 
-static std::string normalizeBrowser(const std::string& b) {
-  if (b == "Chrome" || b == "chrome") return "chrome142";
-  if (b == "Firefox" || b == "firefox") return "firefox144";
-  return b;
-}
+  RequestSpec DefaultSpec() const { return defaults; }
 
-static std::string ensureProxyScheme(const std::string& u) {
-  if (u.rfind("http://", 0) == 0 || u.rfind("https://", 0) == 0 || u.rfind("socks5://", 0) == 0 || u.rfind("socks5h://", 0) == 0 || u.rfind("socks4://", 0) == 0 || u.rfind("socks4a://", 0) == 0) {
-    return u;
+  // Headers from an init: an object, an array of [name, value] pairs, a
+  // flat [name, value, ...] array, or a preencoded "Name: value" block.
+  static void readHeaders(Napi::Value v, std::vector<std::pair<std::string,std::string>>& out) {
+    if (v.IsBuffer()) {
+      Napi::Buffer<char> buf = v.As<Napi::Buffer<char>>();
+      parseHeaderBlock(buf.Data(), buf.Length(), out);
+      return;
+    }
+    if (v.IsString()) {
+      std::string block = v.As<Napi::String>().Utf8Value();
+      parseHeaderBlock(block.data(), block.size(), out);
+      return;
+    }
+    if (v.IsArray()) {
+      Napi::Array arr = v.As<Napi::Array>();
+      uint32_t n = arr.Length();
+      if (n > 0 && !arr.Get((uint32_t)0).IsArray()) {
+        out.reserve(out.size() + n / 2);
+        for (uint32_t i = 0; i + 1 < n; i += 2) {
+          std::string k = arr.Get(i).ToString().Utf8Value();
+          std::string val = arr.Get(i + 1).ToString().Utf8Value();
+          if (sanitizeHeaderKV(k, val)) out.emplace_back(std::move(k), std::move(val));
+        }
+        return;
+      }
+      for (uint32_t i = 0; i < n; ++i) {
+        Napi::Value pair = arr.Get(i);
+        if (!pair.IsArray() || pair.As<Napi::Array>().Length() < 2) continue;
+        std::string k = pair.As<Napi::Array>().Get((uint32_t)0).ToString().Utf8Value();
+        std::string val = pair.As<Napi::Array>().Get((uint32_t)1).ToString().Utf8Value();
+        if (sanitizeHeaderKV(k, val)) out.emplace_back(k, val);
+      }
+      return;
+    }
+    if (!v.IsObject()) return;
+    Napi::Object h = v.As<Napi::Object>();
+    auto props = h.GetPropertyNames();
+    for (uint32_t i = 0; i < props.Length(); ++i) {
+      Napi::Value keyVal = props.Get(i);
+      std::string k = keyVal.As<Napi::String>().Utf8Value();
+      Napi::Value valVal = h.Get(keyVal);
+      std::string val = valVal.IsString()
+        ? valVal.As<Napi::String>().Utf8Value()
+        : valVal.ToString().Utf8Value();
+      if (sanitizeHeaderKV(k, val)) out.emplace_back(k, val);
+    }
   }
-  return std::string("http://") + u;
-}
 
-class ImpitWrapper : public Napi::ObjectWrap<ImpitWrapper> {
-public:
-  static Napi::Function InitClass(Napi::Env env) {
-    return DefineClass(env, "Impit", {
-      InstanceMethod<&ImpitWrapper::Fetch>("fetch"),
-      InstanceMethod<&ImpitWrapper::GetCookies>("getCookies"),
-      InstanceMethod<&ImpitWrapper::SetCookies>("setCookies")
-    });
+  // The client's headers come first, then the request's own. A prebuilt
+  // list goes to `shared` instead: the profile's, or the client's when the
+  // request adds nothing and keeps its User-Agent and Referer.
+  curl_slist* headerList(const RequestSpec& s, std::shared_ptr<curl_slist>& shared) const {
+    if (s.headerList) {
+      shared = s.headerList;
+      return nullptr;
+    }
+    if (s.headers.empty() && s.userAgent == defaults.userAgent && s.referer == defaults.referer) {
+      shared = defaultSlist;
+      return nullptr;
+    }
+    curl_slist* list = nullptr;
+    for (auto& kv : defaultHeaders) appendHeader(list, kv.first, kv.second, s.userAgent, s.referer);
+    for (auto& kv : s.headers) appendHeader(list, kv.first, kv.second, s.userAgent, s.referer);
+    return list;
   }
 
-  ImpitWrapper(const Napi::CallbackInfo& info) : Napi::ObjectWrap<ImpitWrapper>(info) {
-    Napi::Env env = info.Env();
-    if (info.Length() >= 1 && info[0].IsObject()) {
-      Napi::Object o = info[0].As<Napi::Object>();
-      if (o.Has("verbose") && o.Get("verbose").IsBoolean()) verbose = o.Get("verbose").As<Napi::Boolean>().Value();
-      if (o.Has("debug") && o.Get("debug").IsBoolean()) verbose = o.Get("debug").As<Napi::Boolean>().Value();
-      if (o.Has("browser") && o.Get("browser").IsString()) browser = normalizeBrowser(o.Get("browser").As<Napi::String>().Utf8Value());
-      if (o.Has("impersonate") && o.Get("impersonate").IsString()) browser = normalizeBrowser(o.Get("impersonate").As<Napi::String>().Utf8Value());
-      if (o.Has("timeout") && o.Get("timeout").IsNumber()) timeoutMs = o.Get("timeout").As<Napi::Number>().Uint32Value();
-      if (o.Has("ignoreTlsErrors") && o.Get("ignoreTlsErrors").IsBoolean()) verify = !o.Get("ignoreTlsErrors").As<Napi::Boolean>().Value();
-      if (o.Has("caPath") && o.Get("caPath").IsString()) caPath = o.Get("caPath").As<Napi::String>().Utf8Value();
-      if (o.Has("followRedirects") && o.Get("followRedirects").IsBoolean()) followRedirects = o.Get("followRedirects").As<Napi::Boolean>().Value();
-      if (o.Has("proxy") && o.Get("proxy").IsString()) proxyUrl = o.Get("proxy").As<Napi::String>().Utf8Value();
-      if (o.Has("proxyUrl") && o.Get("proxyUrl").IsString()) proxyUrl = o.Get("proxyUrl").As<Napi::String>().Utf8Value();
-      if (o.Has("proxy_username") && o.Get("proxy_username").IsString()) proxyUsername = o.Get("proxy_username").As<Napi::String>().Utf8Value();
-      if (o.Has("proxy_password") && o.Get("proxy_password").IsString()) proxyPassword = o.Get("proxy_password").As<Napi::String>().Utf8Value();
-      if (o.Has("ignoreProxyTlsErrors") && o.Get("ignoreProxyTlsErrors").IsBoolean()) ignoreProxyTlsErrors = o.Get("ignoreProxyTlsErrors").As<Napi::Boolean>().Value();
-      if (o.Has("connectTimeout")) connectTimeoutMs = o.Get("connectTimeout").As<Napi::Number>().Uint32Value();
-      if (o.Has("maxRedirects")) maxRedirects = o.Get("maxRedirects").As<Napi::Number>().Uint32Value();
-      if (o.Has("httpVersion")) {
-        if (o.Get("httpVersion").IsNumber()) httpVersion = o.Get("httpVersion").As<Napi::Number>().Int32Value();
-        else if (o.Get("httpVersion").IsString()) {
-          std::string hv = o.Get("httpVersion").As<Napi::String>().Utf8Value();
-          if (hv == "2" || hv == "h2") httpVersion = 2;
-          else if (hv == "3" || hv == "h3") httpVersion = 3;
+  // Pinned addresses for a DoH setup: the user's host:port:addr entries,
+  // plus the resolver's own address so it can be reached at all.
+  static curl_slist* buildResolveList(const RequestSpec& s) {
+    curl_slist* dohResolve = nullptr;
+    if (!s.dohResolve.empty()) {
+      const std::string& str = s.dohResolve;
+      size_t start = 0;
+      while (start <= str.size()) {
+        size_t sep = str.find_first_of(",;", start);
+        std::string item = str.substr(start, sep == std::string::npos ? std::string::npos : sep - start);
+        if (!item.empty()) {
+          dohResolve = curl_slist_append(dohResolve, item.c_str());
         }
+        if (sep == std::string::npos) break;
+        start = sep + 1;
+      }
+    }
+    std::string host;
+    size_t p = s.dohUrl.find("://");
+    size_t b = (p == std::string::npos) ? 0 : p + 3;
+    size_t e = s.dohUrl.find('/', b);
+    host = s.dohUrl.substr(b, e == std::string::npos ? std::string::npos : e - b);
+    size_t c = host.find(':');
+    if (c != std::string::npos) host = host.substr(0, c);
+    if (host == "cloudflare-dns.com") {
+      dohResolve = curl_slist_append(dohResolve, "cloudflare-dns.com:443:1.1.1.1");
+      dohResolve = curl_slist_append(dohResolve, "cloudflare-dns.com:443:1.0.0.1");
+    }
+    return dohResolve;
+  }
+
+  // Headers arrive sanitized; User-Agent and Referer give way to the
+  // dedicated options when those are set.
+  static void appendHeader(curl_slist*& list, const std::string& k, const std::string& v, const std::string& ua, const std::string& ref) {
+    int known = knownHeader(k);
+    if (known == kHdrUserAgent && !ua.empty()) return;
+    if (known == kHdrReferer && !ref.empty()) return;
+    std::string line;
+    line.reserve(k.size() + v.size() + 2);
+    line.append(k).append(": ").append(v);
+    list = curl_slist_append(list, line.c_str());
+  }
+
+  static void readBody(Napi::Value v, RequestSpec& s) {
+    if (v.IsBuffer()) {
+      Napi::Buffer<uint8_t> buf = v.As<Napi::Buffer<uint8_t>>();
+      s.body.assign(reinterpret_cast<const char*>(buf.Data()), buf.Length());
+      s.hasBody = true;
+    } else if (v.IsString()) {
+      s.body = v.As<Napi::String>().Utf8Value();
+      s.hasBody = true;
+    }
+  }
+
+  // Reads a fetch() init over `s`; `extra` keys are left to the caller.
+  bool ParseInit(Napi::Env env, Napi::Object init, RequestSpec& s, Napi::Value& err, std::initializer_list<std::string_view> extra = {}) {
+    return ParseOptions(env, init, kScopeRequest, s, extra, err);
+  }
+
+  // One pass over the keys present in `o`, dispatched through kOptions.
+  // `extra` names keys the caller reads itself. In client scope the shared
+  // keys land in `s`, the client's defaults.
+  bool ParseOptions(Napi::Env env, Napi::Object o, OptionScope scope, RequestSpec& s, std::initializer_list<std::string_view> extra, Napi::Value& err) {
+    Napi::Array keys = ownKeys(env, o);
+    for (uint32_t i = 0; i < keys.Length(); ++i) {
+      Napi::Value key = keys.Get(i);
+      std::string name = key.ToString().Utf8Value();
+      if (std::find(extra.begin(), extra.end(), name) != extra.end()) continue;
+      const OptionDef* def = findOption(name);
+      if (!def) {
+        err = Napi::TypeError::New(env, "Unknown option '" + name + "'").Value();
+        return false;
+      }
+      if (!(def->scope & scope)) {
+        err = Napi::TypeError::New(env, "Option '" + name + (def->scope & kScopeRequest ? "' is only valid per request" : "' can only be set on the client")).Value();
+        return false;
       }
-      if (o.Has("ipResolve")) ipResolve = o.Get("ipResolve").As<Napi::String>().Utf8Value();
-      if (o.Has("dohUrl")) dohUrl = o.Get("dohUrl").As<Napi::String>().Utf8Value();
-      if (o.Has("dohResolve")) dohResolveString = o.Get("dohResolve").As<Napi::String>().Utf8Value();
-      if (o.Has("ignoreDohTlsErrors")) ignoreDohTlsErrors = o.Get("ignoreDohTlsErrors").As<Napi::Boolean>().Value();
-      if (o.Has("userAgent")) userAgent = o.Get("userAgent").As<Napi::String>().Utf8Value();
-      if (o.Has("referer")) referer = o.Get("referer").As<Napi::String>().Utf8Value();
-      if (o.Has("cookieJarPath")) cookieJarPath = o.Get("cookieJarPath").As<Napi::String>().Utf8Value();
-      if (o.Has("proxy_type")) proxyType = o.Get("proxy_type").As<Napi::String>().Utf8Value();
-      if (o.Has("proxy_auth")) proxyAuth = o.Get("proxy_auth").As<Napi::String>().Utf8Value();
-      if (o.Has("noProxy")) {
-        if (o.Get("noProxy").IsString()) {
-          noProxy = o.Get("noProxy").As<Napi::String>().Utf8Value();
-        } else if (o.Get("noProxy").IsArray()) {
-          Napi::Array arr = o.Get("noProxy").As<Napi::Array>();
-          std::string joined;
-          for (uint32_t i=0;i<arr.Length();++i) {
-            if (arr.Get(i).IsString()) {
-              if (!joined.empty()) joined.push_back(',');
-              joined += arr.Get(i).As<Napi::String>().Utf8Value();
+      Napi::Value v = o.Get(key);
+      if (v.IsUndefined() || v.IsNull()) continue;
+      if (!optionTypeMatches(def->type, v)) {
+        err = Napi::TypeError::New(env, "Option '" + name + "' must be " + optionTypeName(def->type)).Value();
+        return false;
+      }
+      if (!SetOption(env, def->id, v, scope, s, err)) return false;
+    }
+    return true;
+  }
+
+  bool SetOption(Napi::Env env, OptionId id, Napi::Value v, OptionScope scope, RequestSpec& s, Napi::Value& err) {
+    auto str = [&]() { return v.As<Napi::String>().Utf8Value(); };
+    auto u32 = [&]() { return v.As<Napi::Number>().Uint32Value(); };
+    auto flag = [&]() { return v.As<Napi::Boolean>().Value(); };
+    auto strings = [&](auto add) {
+      Napi::Array arr = v.As<Napi::Array>();
+      for (uint32_t i = 0; i < arr.Length(); ++i) {
+        if (arr.Get(i).IsString()) add(arr.Get(i).As<Napi::String>().Utf8Value());
+      }
+    };
+    switch (id) {
+      case kOptVerbose:
+      case kOptDebug:
+      case kOptTrace: verbose = flag(); break;
+      case kOptTraceBufferSize: traceBufferSize = u32(); break;
+      case kOptScheduler: {
+        Napi::Object sc = v.As<Napi::Object>();
+        parseOriginLimits(sc, engine.defaultLimits);
+        if (sc.Has("origins") && sc.Get("origins").IsObject()) {
+          Napi::Object per = sc.Get("origins").As<Napi::Object>();
+          Napi::Array keys = ownKeys(env, per);
+          for (uint32_t i = 0; i < keys.Length(); ++i) {
+            std::string origin = urlOrigin(keys.Get(i).As<Napi::String>().Utf8Value());
+            OriginLimits l = engine.defaultLimits;
+            if (per.Get(keys.Get(i)).IsObject()) parseOriginLimits(per.Get(keys.Get(i)).As<Napi::Object>(), l);
+            engine.originLimits[origin] = l;
+          }
+        }
+        Napi::Value ad = sc.Get("adaptive");
+        engine.adaptive.enabled = ad.IsObject() || (ad.IsBoolean() && ad.As<Napi::Boolean>().Value());
+        if (ad.IsObject()) {
+          parseAdaptiveConfig(ad.As<Napi::Object>(), engine.adaptive);
+          Napi::Value seeded = ad.As<Napi::Object>().Get("limits");
+          if (seeded.IsObject()) {
+            Napi::Object lim = seeded.As<Napi::Object>();
+            Napi::Array keys = ownKeys(env, lim);
+            for (uint32_t i = 0; i < keys.Length(); ++i) {
+              Napi::Value l = lim.Get(keys.Get(i));
+              if (l.IsObject()) l = l.As<Napi::Object>().Get("limit");
+              if (l.IsNumber()) engine.seedLimit(urlOrigin(keys.Get(i).As<Napi::String>().Utf8Value()), l.As<Napi::Number>().DoubleValue());
             }
           }
-          noProxy = joined;
         }
+        break;
+      }
+      case kOptCompletions: {
+        Napi::Object c = v.As<Napi::Object>();
+        if (c.Has("maxBatch") && c.Get("maxBatch").IsNumber()) engine.batchMax = c.Get("maxBatch").As<Napi::Number>().Uint32Value();
+        if (c.Has("maxDelay") && c.Get("maxDelay").IsNumber()) engine.batchDelay = std::max<int64_t>(0, c.Get("maxDelay").As<Napi::Number>().Int64Value());
+        break;
+      }
+      case kOptCircuitBreaker: {
+        Napi::Object cb = v.As<Napi::Object>();
+        breakers = true;
+        for (CircuitBreakers* b : { &originBreakers, &proxyBreakers }) {
+          if (cb.Has("threshold") && cb.Get("threshold").IsNumber()) b->threshold = std::max(1u, cb.Get("threshold").As<Napi::Number>().Uint32Value());
+          if (cb.Has("resetTimeout") && cb.Get("resetTimeout").IsNumber()) b->resetMs = cb.Get("resetTimeout").As<Napi::Number>().Uint32Value();
+          if (cb.Has("halfOpenProbes") && cb.Get("halfOpenProbes").IsNumber()) b->halfOpenProbes = std::max(1u, cb.Get("halfOpenProbes").As<Napi::Number>().Uint32Value());
+        }
+        break;
       }
-      if (o.Has("headers") && o.Get("headers").IsObject()) {
-        Napi::Object h = o.Get("headers").As<Napi::Object>();
-        auto props = h.GetPropertyNames();
-        for (uint32_t i = 0; i < props.Length(); ++i) {
-          Napi::Value keyVal = props.Get(i);
-          std::string k = keyVal.As<Napi::String>().Utf8Value();
-          Napi::Value valVal = h.Get(keyVal);
-          std::string v = valVal.IsString()
-            ? valVal.As<Napi::String>().Utf8Value()
-            : valVal.ToString().Utf8Value();
-          if (sanitizeHeaderKV(k, v)) {
-            defaultHeaders.emplace_back(k, v);
+      case kOptBrowser:
+      case kOptImpersonate: browser = normalizeBrowser(str()); break;
+      case kOptMetrics: metricsEnabled = flag(); break;
+      case kOptMetricsMaxKeys: metrics.maxKeys = u32(); break;
+      case kOptIgnoreTlsErrors: verify = !flag(); break;
+      case kOptCaPath: caPath = str(); break;
+      case kOptFollowRedirects: followRedirects = flag(); break;
+      case kOptProxies: strings([&](const std::string& p) { proxyPool.add(p); }); break;
+      case kOptProxyRotation: proxyPool.setStrategy(str()); break;
+      case kOptProxyBanTime: proxyPool.banMs = u32(); break;
+      case kOptProxyMaxRetries: proxyPool.maxRetries = u32(); break;
+      case kOptLocalAddresses: strings([&](const std::string& a) { localAddressPool.add(a); }); break;
+      case kOptLocalAddressMode: localAddressPool.sticky = str() != "round-robin"; break;
+      case kOptLocalAddressSpillAt: localAddressPool.spillAt = u32(); break;
+      case kOptHeaders:
+        s.headerList.reset();
+        readHeaders(v, scope == kScopeClient ? defaultHeaders : s.headers);
+        break;
+      case kOptTimeout: s.timeoutMs = u32(); break;
+      case kOptTimeouts: parsePhaseDeadlines(v.As<Napi::Object>(), s.deadlines, s.timeoutMs); break;
+      case kOptTimings: s.timings = flag(); break;
+      case kOptLowSpeedLimit: s.lowSpeedLimit = u32(); break;
+      case kOptLowSpeedTime: s.lowSpeedTime = u32(); break;
+      case kOptHedge:
+        if (v.IsBoolean()) {
+          s.hedgeDelay = flag() ? std::max(defaults.hedgeDelay, 0) : -1;
+        } else if (v.IsNumber()) {
+          s.hedgeDelay = std::max(0, v.As<Napi::Number>().Int32Value());
+        } else if (v.IsObject()) {
+          Napi::Object h = v.As<Napi::Object>();
+          Napi::Value d = h.Get("delay");
+          s.hedgeDelay = d.IsNumber() ? std::max(0, d.As<Napi::Number>().Int32Value()) : 0;
+          if (scope == kScopeClient) {
+            if (h.Has("percentile") && h.Get("percentile").IsNumber()) engine.hedgePercentile = std::min(1.0, std::max(0.0, h.Get("percentile").As<Napi::Number>().DoubleValue()));
+            if (h.Has("budget") && h.Get("budget").IsNumber()) engine.hedgeBudget = std::max(0.0, h.Get("budget").As<Napi::Number>().DoubleValue());
           }
         }
+        break;
+      case kOptProxy:
+      case kOptProxyUrl: s.proxy = str(); break;
+      case kOptProxyUsername: s.proxyUser = str(); break;
+      case kOptProxyPassword: s.proxyPass = str(); break;
+      case kOptProxyType: s.proxyType = str(); break;
+      case kOptProxyAuth: s.proxyAuth = str(); break;
+      case kOptNoProxy:
+        if (v.IsString()) {
+          s.noProxy = str();
+        } else {
+          s.noProxy.clear();
+          strings([&](const std::string& h) {
+            if (!s.noProxy.empty()) s.noProxy.push_back(',');
+            s.noProxy += h;
+          });
+        }
+        break;
+      case kOptIgnoreProxyTlsErrors: s.ignoreProxyTls = flag(); break;
+      case kOptUnixSocketPath: s.unixSocket = str(); break;
+      case kOptAbstractUnixSocket: s.abstractUnix = str(); break;
+      case kOptSocket: parseSocketTuning(v.As<Napi::Object>(), s.socket); break;
+      case kOptConnectTimeout: s.connectTimeout = u32(); break;
+      case kOptMaxRedirects: s.maxRedirects = u32(); break;
+      case kOptHttpVersion:
+        if (v.IsNumber()) {
+          s.httpVersion = v.As<Napi::Number>().Int32Value();
+        } else {
+          std::string hv = str();
+          if (hv == "2" || hv == "h2") s.httpVersion = 2;
+          else if (hv == "3" || hv == "h3") s.httpVersion = 3;
+        }
+        break;
+      case kOptForceHttp3: s.forceHttp3 = flag(); break;
+      case kOptIpResolve: s.ipResolve = str(); break;
+      case kOptDohUrl:
+        s.resolveList.reset();
+        s.dohUrl = str();
+        break;
+      case kOptDohResolve:
+        s.resolveList.reset();
+        s.dohResolve = str();
+        break;
+      case kOptIgnoreDohTlsErrors: s.ignoreDohTls = flag(); break;
+      case kOptUserAgent:
+        s.headerList.reset();
+        s.userAgent = str();
+        break;
+      case kOptReferer:
+        s.headerList.reset();
+        s.referer = str();
+        break;
+      case kOptCookieJarPath: s.cookieJarPath = str(); break;
+      case kOptMethod: s.method = str(); break;
+      case kOptBody: readBody(v, s); break;
+      case kOptSignal: break;
+      case kOptSessionId: s.sessionId = str(); break;
+      case kOptLocalAddress: s.localAddress = str(); break;
+      case kOptPriority: s.lane = str() == "bulk" ? kLaneBulk : kLaneInteractive; break;
+      case kOptGroup: {
+        Napi::Value gid = v.As<Napi::Object>().Get("id");
+        auto it = gid.IsNumber() ? groups.find((uint64_t)gid.As<Napi::Number>().Int64Value()) : groups.end();
+        if (it == groups.end() || !(s.group = it->second.lock())) {
+          err = Napi::TypeError::New(env, "Unknown request group").Value();
+          return false;
+        }
+        break;
       }
+      case kOptionCount: break;
     }
+    return true;
   }
 
-  Napi::Value Fetch(const Napi::CallbackInfo& info) {
-    Napi::Env env = info.Env();
-    auto deferred = Napi::Promise::Deferred::New(env);
-    if (info.Length() < 1) {
-      deferred.Reject(Napi::Error::New(env, "url required").Value());
-      return deferred.Promise();
-    }
-    std::string url = info[0].As<Napi::String>().Utf8Value();
-    std::string method = "GET";
-    std::vector<std::pair<std::string,std::string>> headers = defaultHeaders;
-    std::string bodyStr;
-    bool hasBody = false;
-    uint32_t reqTimeout = timeoutMs;
-    bool forceHttp3 = false; // ignored
+  // Builds the easy handle for `t->url` from a resolved spec, loading `jar`
+  // into its cookie engine. Touches no JS state, so the job runner thread
+  // can use it too. On failure nothing has been acquired.
+  bool BuildTransfer(Transfer& tr, const RequestSpec& s, const std::vector<std::string>& jar, BuildError& err) {
+    Transfer* t = &tr;
+    const std::string& url = t->url;
+    std::string& upperMethod = t->method;
+    upperMethod = s.method;
+    std::transform(upperMethod.begin(), upperMethod.end(), upperMethod.begin(), ::toupper);
+    if ((upperMethod == "GET" || upperMethod == "HEAD") && s.hasBody) {
+      err.message = "GET/HEAD methods don't support passing a request body";
+      return false;
+    }
+    t->body = s.body;
+    t->sessionId = s.sessionId;
+    t->group = s.group;
+    t->lane = s.lane;
+    t->hedgeDelay = s.hedgeDelay;
+    // Only idempotent requests are safe to send twice.
+    static const char* const kIdempotent[] = { "GET", "HEAD", "OPTIONS", "PUT", "DELETE", "TRACE" };
+    if (std::none_of(std::begin(kIdempotent), std::end(kIdempotent), [&](const char* m) { return upperMethod == m; })) t->hedgeDelay = -1;
+    if (t->hedgeDelay >= 0) t->hedgeJar = jar;
+    t->wantTimings = s.timings;
+    DeadlineWatch& watch = t->watch;
+    watch.limits = s.deadlines;
 
-    if (info.Length() >= 2 && info[1].IsObject()) {
-      Napi::Object init = info[1].As<Napi::Object>();
-      if (init.Has("method")) method = init.Get("method").As<Napi::String>().Utf8Value();
-      if (init.Has("headers") && init.Get("headers").IsObject()) {
-        Napi::Object h = init.Get("headers").As<Napi::Object>();
-        auto props = h.GetPropertyNames();
-        for (uint32_t i = 0; i < props.Length(); ++i) {
-          Napi::Value keyVal = props.Get(i);
-          std::string k = keyVal.As<Napi::String>().Utf8Value();
-          Napi::Value valVal = h.Get(keyVal);
-          std::string v = valVal.IsString()
-            ? valVal.As<Napi::String>().Utf8Value()
-            : valVal.ToString().Utf8Value();
-          if (sanitizeHeaderKV(k, v)) {
-            headers.emplace_back(k, v);
-          }
-        }
+    t->origin = urlOrigin(url);
+    int64_t retryIn = 0;
+    if (breakers) {
+      CircuitBreakers::Verdict v = originBreakers.admit(t->origin, retryIn);
+      if (v == CircuitBreakers::kReject) {
+        err.key = t->origin;
+        err.retryInMs = retryIn;
+        return false;
       }
-      if (init.Has("body")) {
-        if (init.Get("body").IsBuffer()) {
-          Napi::Buffer<uint8_t> buf = init.Get("body").As<Napi::Buffer<uint8_t>>();
-          bodyStr.assign(reinterpret_cast<const char*>(buf.Data()), buf.Length());
-          hasBody = true;
-        } else if (init.Get("body").IsString()) {
-          bodyStr = init.Get("body").As<Napi::String>().Utf8Value();
-          hasBody = true;
+      t->originProbe = v == CircuitBreakers::kProbe;
+    }
+    // Pooled proxies have their own bans; fixed ones get a breaker, keyed
+    // without credentials since breakerStats() hands the keys to JS.
+    std::string& usedProxy = t->proxy;
+    if (!s.proxy.empty()) {
+      usedProxy = ensureProxyScheme(s.proxy);
+      if (breakers) {
+        std::string key = redactProxy(usedProxy);
+        CircuitBreakers::Verdict v = proxyBreakers.admit(key, retryIn);
+        if (v == CircuitBreakers::kReject) {
+          if (t->originProbe) originBreakers.record(t->origin, true, CircuitBreakers::kNeutral, CURLE_OK);
+          err.key = key;
+          err.retryInMs = retryIn;
+          return false;
         }
+        t->proxyProbe = v == CircuitBreakers::kProbe;
       }
-      if (init.Has("timeout")) reqTimeout = init.Get("timeout").As<Napi::Number>().Uint32Value();
-      if (init.Has("force_http3")) forceHttp3 = init.Get("force_http3").As<Napi::Boolean>().Value();
-    }
-
-    std::string upperMethod = method;
-    std::transform(upperMethod.begin(), upperMethod.end(), upperMethod.begin(), ::toupper);
-    if ((upperMethod == "GET" || upperMethod == "HEAD") && hasBody) {
-      deferred.Reject(Napi::Error::New(env, "GET/HEAD methods don't support passing a request body").Value());
-      return deferred.Promise();
     }
 
-    CURL* curl = curl_easy_init();
+    CURL* curl = t->curl = curl_easy_init();
     if (!curl) {
-      deferred.Reject(Napi::Error::New(env, "curl_easy_init failed").Value());
-      return deferred.Promise();
+      err.message = "curl_easy_init failed";
+      return false;
     }
-    
+    uint64_t requestId = t->id = ++nextRequestId;
+    const std::string& host = t->host = urlHost(url);
+    CURLNAPI_PROBE3(request__start, requestId, host.c_str(), upperMethod.c_str());
+
+    if (share) curl_easy_setopt(curl, CURLOPT_SHARE, share);
     // Cookie Engine & Jar
-    curl_easy_setopt(curl, CURLOPT_COOKIEFILE, ""); 
-    for(const auto& c : cookieJar) {
+    curl_easy_setopt(curl, CURLOPT_COOKIEFILE, "");
+    for(const auto& c : jar) {
       curl_easy_setopt(curl, CURLOPT_COOKIELIST, c.c_str());
     }
 
@@ -247,7 +4238,24 @@ public:
     }
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, reqTimeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, s.timeoutMs);
+    t->timeoutMs = s.timeoutMs;
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, t->errbuf);
+    if (s.lowSpeedLimit > 0 && s.lowSpeedTime > 0) {
+      curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long)s.lowSpeedLimit);
+      curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)s.lowSpeedTime);
+    }
+    // The progress callback only runs when a phase deadline is configured
+    // or a tracer is attached to the phase probes.
+    watch.probes = phaseProbesEnabled();
+    watch.requestId = requestId;
+    watch.host = host.c_str();
+    if (watch.limits.any() || watch.probes) {
+      watch.curl = curl;
+      curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, deadline_cb);
+      curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &watch);
+      curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    }
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, followRedirects ? 1L : 0L);
     if (!verify) {
       curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
@@ -257,162 +4265,100 @@ public:
       curl_easy_setopt(curl, CURLOPT_CAINFO, caPath.c_str());
       curl_easy_setopt(curl, CURLOPT_PROXY_CAINFO, caPath.c_str());
     }
-    uint32_t effConnectTimeout = connectTimeoutMs;
-    uint32_t effMaxRedirects = maxRedirects;
-    int effHttpVersion = httpVersion;
-    std::string effIpResolve = ipResolve;
-    std::string effDohUrl = dohUrl;
-    std::string effDohResolve = dohResolveString;
-    bool effIgnoreDohTls = ignoreDohTlsErrors;
-    std::string effUserAgent = userAgent;
-
-    // Apply other options...
-    if (effConnectTimeout > 0) curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, effConnectTimeout);
-    if (effMaxRedirects > 0) curl_easy_setopt(curl, CURLOPT_MAXREDIRS, effMaxRedirects);
-    if (effHttpVersion != 0) {
-      if (effHttpVersion == 2) curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
-      else if (effHttpVersion == 3) curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_3);
-    }
-    if (!effIpResolve.empty()) {
-      if (effIpResolve == "v4") curl_easy_setopt(curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
-      else if (effIpResolve == "v6") curl_easy_setopt(curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6);
-    }
+    std::string effIpResolve = s.ipResolve;
     // IMPORTANT: When using c-ares (which curl-impersonate uses statically), 
     // it might not read /etc/resolv.conf correctly in some environments or if permissions issue.
     // Explicitly setting DNS servers helps.
-    if (!effDohUrl.empty()) {
-      curl_easy_setopt(curl, CURLOPT_DOH_URL, effDohUrl.c_str());
-      if (effIgnoreDohTls) {
+    if (!s.dohUrl.empty()) {
+      curl_easy_setopt(curl, CURLOPT_DOH_URL, s.dohUrl.c_str());
+      if (s.ignoreDohTls) {
         curl_easy_setopt(curl, CURLOPT_DOH_SSL_VERIFYPEER, 0L);
         curl_easy_setopt(curl, CURLOPT_DOH_SSL_VERIFYHOST, 0L);
       }
     }
-    struct curl_slist* dohResolve = NULL;
-    if (!effDohUrl.empty()) {
-      if (!effDohResolve.empty()) {
-        std::string s = effDohResolve;
-        size_t start = 0;
-        while (start <= s.size()) {
-          size_t sep = s.find_first_of(",;", start);
-          std::string item = s.substr(start, sep == std::string::npos ? std::string::npos : sep - start);
-          if (!item.empty()) {
-            dohResolve = curl_slist_append(dohResolve, item.c_str());
-          }
-          if (sep == std::string::npos) break;
-          start = sep + 1;
-        }
-      }
-      std::string host;
-      size_t p = effDohUrl.find("://");
-      size_t s = (p == std::string::npos) ? 0 : p + 3;
-      size_t e = effDohUrl.find('/', s);
-      host = effDohUrl.substr(s, e == std::string::npos ? std::string::npos : e - s);
-      size_t c = host.find(':');
-      if (c != std::string::npos) host = host.substr(0, c);
-      if (host == "cloudflare-dns.com") {
-        dohResolve = curl_slist_append(dohResolve, "cloudflare-dns.com:443:1.1.1.1");
-        dohResolve = curl_slist_append(dohResolve, "cloudflare-dns.com:443:1.0.0.1");
-      }
-      if (dohResolve) {
-        curl_easy_setopt(curl, CURLOPT_RESOLVE, dohResolve);
-      }
-    }
-    if (!effUserAgent.empty()) curl_easy_setopt(curl, CURLOPT_USERAGENT, effUserAgent.c_str());
-    std::string effReferer = referer;
-    std::string effCookieJar = cookieJarPath;
-    std::string effProxyType = proxyType;
-    std::string effProxyAuth = proxyAuth;
-    std::string effProxy = proxyUrl;
-    std::string effProxyUser = proxyUsername;
-    std::string effProxyPass = proxyPassword;
-    std::string effNoProxy = noProxy;
-    bool effIgnoreProxyTls = ignoreProxyTlsErrors;
-    if (info.Length() >= 2 && info[1].IsObject()) {
-      Napi::Object init = info[1].As<Napi::Object>();
-      if (init.Has("proxy") && init.Get("proxy").IsString()) effProxy = init.Get("proxy").As<Napi::String>().Utf8Value();
-      if (init.Has("proxy_username") && init.Get("proxy_username").IsString()) effProxyUser = init.Get("proxy_username").As<Napi::String>().Utf8Value();
-      if (init.Has("proxy_password") && init.Get("proxy_password").IsString()) effProxyPass = init.Get("proxy_password").As<Napi::String>().Utf8Value();
-      if (init.Has("ignoreProxyTlsErrors") && init.Get("ignoreProxyTlsErrors").IsBoolean()) effIgnoreProxyTls = init.Get("ignoreProxyTlsErrors").As<Napi::Boolean>().Value();
-      if (init.Has("connectTimeout")) effConnectTimeout = init.Get("connectTimeout").As<Napi::Number>().Uint32Value();
-      if (init.Has("maxRedirects")) effMaxRedirects = init.Get("maxRedirects").As<Napi::Number>().Uint32Value();
-      if (init.Has("httpVersion")) {
-        if (init.Get("httpVersion").IsNumber()) effHttpVersion = init.Get("httpVersion").As<Napi::Number>().Int32Value();
-        else if (init.Get("httpVersion").IsString()) {
-          std::string hv = init.Get("httpVersion").As<Napi::String>().Utf8Value();
-          if (hv == "2" || hv == "h2") effHttpVersion = 2;
-          else if (hv == "3" || hv == "h3") effHttpVersion = 3;
-        }
-      }
-      if (init.Has("ipResolve")) effIpResolve = init.Get("ipResolve").As<Napi::String>().Utf8Value();
-      if (init.Has("dohUrl")) effDohUrl = init.Get("dohUrl").As<Napi::String>().Utf8Value();
-      if (init.Has("dohResolve")) effDohResolve = init.Get("dohResolve").As<Napi::String>().Utf8Value();
-      if (init.Has("ignoreDohTlsErrors")) effIgnoreDohTls = init.Get("ignoreDohTlsErrors").As<Napi::Boolean>().Value();
-      if (init.Has("userAgent")) effUserAgent = init.Get("userAgent").As<Napi::String>().Utf8Value();
-      if (init.Has("referer")) effReferer = init.Get("referer").As<Napi::String>().Utf8Value();
-      if (init.Has("cookieJarPath")) effCookieJar = init.Get("cookieJarPath").As<Napi::String>().Utf8Value();
-      if (init.Has("proxy_type")) effProxyType = init.Get("proxy_type").As<Napi::String>().Utf8Value();
-      if (init.Has("proxy_auth")) effProxyAuth = init.Get("proxy_auth").As<Napi::String>().Utf8Value();
-      if (init.Has("noProxy")) {
-        if (init.Get("noProxy").IsString()) {
-          effNoProxy = init.Get("noProxy").As<Napi::String>().Utf8Value();
-        } else if (init.Get("noProxy").IsArray()) {
-          Napi::Array arr = init.Get("noProxy").As<Napi::Array>();
-          std::string joined;
-          for (uint32_t i=0;i<arr.Length();++i) {
-            if (arr.Get(i).IsString()) {
-              if (!joined.empty()) joined.push_back(',');
-              joined += arr.Get(i).As<Napi::String>().Utf8Value();
-            }
-          }
-          effNoProxy = joined;
-        }
-      }
+    if (!s.dohUrl.empty()) {
+      if (s.resolveList) t->sharedResolve = s.resolveList;
+      else t->resolve = buildResolveList(s);
+      if (curl_slist* list = t->sharedResolve ? t->sharedResolve.get() : t->resolve) curl_easy_setopt(curl, CURLOPT_RESOLVE, list);
     }
-    if (!effProxy.empty()) {
-      std::string p = ensureProxyScheme(effProxy);
-      curl_easy_setopt(curl, CURLOPT_PROXY, p.c_str());
+    // An explicit per-request proxy bypasses the pool.
+    int& proxyIdx = t->proxyIdx;
+    if (!usedProxy.empty()) {
+      curl_easy_setopt(curl, CURLOPT_PROXY, usedProxy.c_str());
+    } else if (!proxyPool.empty()) {
+      proxyIdx = proxyPool.acquire(s.sessionId, t->triedProxies);
+      usedProxy = proxyPool.url(proxyIdx);
+      t->pooledProxy = true;
+      curl_easy_setopt(curl, CURLOPT_PROXY, usedProxy.c_str());
     }
-    if (!effProxyType.empty()) {
+    if (!s.proxyType.empty()) {
       long pt = CURLPROXY_HTTP;
-      if (effProxyType == "http") pt = CURLPROXY_HTTP;
-      else if (effProxyType == "socks5") pt = CURLPROXY_SOCKS5;
-      else if (effProxyType == "socks5h") pt = CURLPROXY_SOCKS5_HOSTNAME;
-      else if (effProxyType == "socks4") pt = CURLPROXY_SOCKS4;
-      else if (effProxyType == "socks4a") pt = CURLPROXY_SOCKS4A;
+      if (s.proxyType == "http") pt = CURLPROXY_HTTP;
+      else if (s.proxyType == "socks5") pt = CURLPROXY_SOCKS5;
+      else if (s.proxyType == "socks5h") pt = CURLPROXY_SOCKS5_HOSTNAME;
+      else if (s.proxyType == "socks4") pt = CURLPROXY_SOCKS4;
+      else if (s.proxyType == "socks4a") pt = CURLPROXY_SOCKS4A;
       curl_easy_setopt(curl, CURLOPT_PROXYTYPE, pt);
     }
-    if (!effProxyAuth.empty()) {
+    if (!s.proxyAuth.empty()) {
       long pa = CURLAUTH_ANY;
-      if (effProxyAuth == "basic") pa = CURLAUTH_BASIC;
-      else if (effProxyAuth == "digest") pa = CURLAUTH_DIGEST;
-      else if (effProxyAuth == "ntlm") pa = CURLAUTH_NTLM;
-      else if (effProxyAuth == "any") pa = CURLAUTH_ANY;
+      if (s.proxyAuth == "basic") pa = CURLAUTH_BASIC;
+      else if (s.proxyAuth == "digest") pa = CURLAUTH_DIGEST;
+      else if (s.proxyAuth == "ntlm") pa = CURLAUTH_NTLM;
+      else if (s.proxyAuth == "any") pa = CURLAUTH_ANY;
       curl_easy_setopt(curl, CURLOPT_PROXYAUTH, pa);
     }
-    if (!effProxyUser.empty()) {
-      curl_easy_setopt(curl, CURLOPT_PROXYUSERNAME, effProxyUser.c_str());
+    if (!s.proxyUser.empty()) {
+      curl_easy_setopt(curl, CURLOPT_PROXYUSERNAME, s.proxyUser.c_str());
     }
-    if (!effProxyPass.empty()) {
-      curl_easy_setopt(curl, CURLOPT_PROXYPASSWORD, effProxyPass.c_str());
+    if (!s.proxyPass.empty()) {
+      curl_easy_setopt(curl, CURLOPT_PROXYPASSWORD, s.proxyPass.c_str());
     }
-    if (!effNoProxy.empty()) {
-      curl_easy_setopt(curl, CURLOPT_NOPROXY, effNoProxy.c_str());
+    if (!s.noProxy.empty()) {
+      curl_easy_setopt(curl, CURLOPT_NOPROXY, s.noProxy.c_str());
     }
-    if (effIgnoreProxyTls) {
+    if (s.ignoreProxyTls) {
       curl_easy_setopt(curl, CURLOPT_PROXY_SSL_VERIFYPEER, 0L);
       curl_easy_setopt(curl, CURLOPT_PROXY_SSL_VERIFYHOST, 0L);
     }
-    if (effConnectTimeout > 0) {
-      curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)effConnectTimeout);
+    if (s.connectTimeout > 0) {
+      curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)s.connectTimeout);
     }
-    if (effMaxRedirects > 0) {
-      curl_easy_setopt(curl, CURLOPT_MAXREDIRS, (long)effMaxRedirects);
+    if (s.maxRedirects > 0) {
+      curl_easy_setopt(curl, CURLOPT_MAXREDIRS, (long)s.maxRedirects);
     }
-    if (forceHttp3 || effHttpVersion == 3) {
+    if (s.forceHttp3 || s.httpVersion == 3) {
       curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_3);
-    } else if (effHttpVersion == 2) {
+    } else if (s.httpVersion == 2) {
       curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2_0);
     }
+    // curl refuses to reuse a connection bound to a different interface, so
+    // the source address is effectively part of the connection pool key.
+    int& localIdx = t->localIdx;
+    int localFamily = 0;
+    std::string localIface;
+    if (!s.localAddress.empty()) {
+      LocalAddressPool single;
+      single.add(s.localAddress);
+      single.acquire(host, localIface, localFamily);
+    } else if (!localAddressPool.empty()) {
+      localIdx = localAddressPool.acquire(host, localIface, localFamily);
+    }
+    if (!localIface.empty()) {
+      curl_easy_setopt(curl, CURLOPT_INTERFACE, localIface.c_str());
+      // A bound socket can only reach hosts of its own family.
+      if (effIpResolve.empty() && localFamily == 4) effIpResolve = "v4";
+      else if (effIpResolve.empty() && localFamily == 6) effIpResolve = "v6";
+    }
+    t->socket = s.socket;
+    applySocketTuning(curl, &t->socket);
+    // The socket replaces only the TCP hop; TLS and impersonation still run
+    // end to end over it, and a proxy set alongside is reached through it.
+    if (!s.abstractUnix.empty()) {
+      curl_easy_setopt(curl, CURLOPT_ABSTRACT_UNIX_SOCKET, s.abstractUnix.c_str());
+    } else if (!s.unixSocket.empty()) {
+      curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, s.unixSocket.c_str());
+    }
     if (!effIpResolve.empty()) {
       long ir = CURL_IPRESOLVE_WHATEVER;
       if (effIpResolve == "v4") ir = CURL_IPRESOLVE_V4;
@@ -420,170 +4366,298 @@ public:
       curl_easy_setopt(curl, CURLOPT_IPRESOLVE, ir);
     }
 
-    if (verbose) {
+    t->trace = TraceCtx{ traceRing.get(), requestId };
+    if (traceRing) {
+      // The sent header block arrives through the debug callback, including
+      // the headers added by impersonation.
+      traceRing->push(requestId, kTraceRequest, upperMethod + " " + url);
+      curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, debug_cb);
+      curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &t->trace);
       curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-      std::cerr << "[curlnapi] " << upperMethod << " " << url << "\n";
-      for (auto& kv : headers) {
-        std::cerr << "[curlnapi] > " << kv.first << ": " << kv.second << "\n";
-      }
-    }
-    if (!effDohUrl.empty()) {
-      curl_easy_setopt(curl, CURLOPT_DOH_URL, effDohUrl.c_str());
-      if (effIgnoreDohTls) {
-        curl_easy_setopt(curl, CURLOPT_DOH_SSL_VERIFYPEER, 0L);
-        curl_easy_setopt(curl, CURLOPT_DOH_SSL_VERIFYHOST, 0L);
-      }
-    }
-    if (!effUserAgent.empty()) {
-      curl_easy_setopt(curl, CURLOPT_USERAGENT, effUserAgent.c_str());
     }
-    if (!effReferer.empty()) {
-      curl_easy_setopt(curl, CURLOPT_REFERER, effReferer.c_str());
+    if (!s.userAgent.empty()) {
+      curl_easy_setopt(curl, CURLOPT_USERAGENT, s.userAgent.c_str());
     }
-    if (!effCookieJar.empty()) {
-      curl_easy_setopt(curl, CURLOPT_COOKIEJAR, effCookieJar.c_str());
+    if (!s.referer.empty()) {
+      curl_easy_setopt(curl, CURLOPT_REFERER, s.referer.c_str());
     }
-    // Headers
-    struct curl_slist* chunk = NULL;
-    for (auto& kv : headers) {
-      std::string k = kv.first;
-      std::string v = kv.second;
-      if (!effUserAgent.empty()) {
-        std::string lk = k;
-        std::transform(lk.begin(), lk.end(), lk.begin(), ::tolower);
-        if (lk == "user-agent") continue;
-      }
-      if (!effReferer.empty()) {
-        std::string lk2 = k;
-        std::transform(lk2.begin(), lk2.end(), lk2.begin(), ::tolower);
-        if (lk2 == "referer") continue;
-      }
-      if (!sanitizeHeaderKV(k, v)) continue;
-      std::string line = k + ": " + v;
-      chunk = curl_slist_append(chunk, line.c_str());
+    if (!s.cookieJarPath.empty()) {
+      curl_easy_setopt(curl, CURLOPT_COOKIEJAR, s.cookieJarPath.c_str());
     }
-    if (chunk) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+    t->headers = headerList(s, t->sharedHeaders);
+    if (curl_slist* list = t->sharedHeaders ? t->sharedHeaders.get() : t->headers) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
     // Method & body
+    const std::string& bodyStr = t->body;
     if (upperMethod == "GET") {
       curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
     } else if (upperMethod == "HEAD") {
       curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
     } else if (upperMethod == "POST") {
       curl_easy_setopt(curl, CURLOPT_POST, 1L);
-      if (hasBody) {
+      if (s.hasBody) {
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, bodyStr.c_str());
         curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)bodyStr.size());
       }
     } else {
       curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, upperMethod.c_str());
-      if (hasBody) {
+      if (s.hasBody) {
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, bodyStr.c_str());
         curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)bodyStr.size());
       }
     }
     // Collect body and headers
-    std::string respBody;
-    HeaderCollector hc;
-    Napi::Function evalFn = env.Global().Get("eval").As<Napi::Function>();
-    Napi::Function makeHelper = evalFn.Call({ Napi::String::New(env, "(function(){let ctrl;const s=new ReadableStream({start(c){ctrl=c}});return {s,e:function(buf){ctrl.enqueue(buf)},c:function(){ctrl.close()}}})") }).As<Napi::Function>();
-    Napi::Object helper = makeHelper.Call({}).As<Napi::Object>();
-    Napi::Value jsStream = helper.Get("s");
-    Napi::Function enqueueFn = helper.Get("e").As<Napi::Function>();
-    Napi::Function closeFn = helper.Get("c").As<Napi::Function>();
-    StreamCtx streamCtx{ env, Napi::Persistent(enqueueFn) };
-    WriteData wd{ &respBody, &streamCtx };
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_stream_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &wd);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &hc);
-
-    CURLcode rc = curl_easy_perform(curl);
-    long status = 0;
-    char* effUrl = nullptr;
-    if (rc == CURLE_OK) {
-      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
-      curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effUrl);
-      if (verbose) {
-        std::cerr << "[curlnapi] < status " << status << " " << (effUrl ? std::string(effUrl) : url) << "\n";
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, xfer_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, t);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, xfer_header_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, t);
+    curl_easy_setopt(curl, CURLOPT_PREREQFUNCTION, xfer_prereq_cb);
+    curl_easy_setopt(curl, CURLOPT_PREREQDATA, t);
+    t->submitted = nowMs();
+    return true;
+  }
+
+  // Aborting removes the handle from the engine right away, which frees
+  // its connection and buffers instead of letting the download finish.
+  void WatchSignal(Napi::Env env, Transfer& t) {
+    if (t.signal.IsEmpty()) return;
+    uint64_t id = t.id;
+    Napi::Object signal = t.signal.Value();
+    Napi::Function onAbort = Napi::Function::New(env, [this, id](const Napi::CallbackInfo& info) {
+      engine.cancel(id);
+      return info.Env().Undefined();
+    });
+    Napi::Object opts = Napi::Object::New(env);
+    opts.Set("once", Napi::Boolean::New(env, true));
+    signal.Get("addEventListener").As<Napi::Function>().Call(signal, { Napi::String::New(env, "abort"), onAbort, opts });
+    t.onAbort = Napi::Persistent(onAbort);
+  }
+
+  // The client stays referenced, and the settle callback keeps the loop
+  // alive, while anything is in flight.
+  void Track(Napi::Env env, uint32_t n) {
+    if (inflight == 0) {
+      settleFn.Ref(env);
+      Ref();
+    }
+    inflight += n;
+  }
+
+  // Engine thread: fail over to the next pooled proxy when the attempt died
+  // on the proxy itself. Runs under the engine lock.
+  bool RetryTransfer(Transfer* t) {
+    if (t->proxyIdx < 0) return false;
+    CURL* curl = t->curl;
+    curl_off_t connectUs = 0;
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connectUs);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    CURLcode proxyRc = (t->rc == CURLE_ABORTED_BY_CALLBACK && t->watch.expired) ? CURLE_OPERATION_TIMEDOUT : t->rc;
+    bool failed = t->rc != CURLE_OK && isProxyFailure(curl, proxyRc);
+    proxyPool.release(t->proxyIdx, !failed, connects > 0 ? connectUs / 1000.0 : 0);
+    int prev = t->proxyIdx;
+    t->proxyIdx = -1;
+    if (!failed || t->triedProxies.size() >= proxyPool.maxRetries) return false;
+    t->triedProxies.push_back(prev);
+    t->proxyIdx = proxyPool.acquire(t->sessionId, t->triedProxies);
+    if (t->proxyIdx < 0) return false;
+    t->proxy = proxyPool.url(t->proxyIdx);
+    curl_easy_setopt(curl, CURLOPT_PROXY, t->proxy.c_str());
+    t->respBody.clear();
+    t->hc.clear();
+    t->bytesDown.store(0, std::memory_order_relaxed);
+    t->phase.store(kXferConnecting, std::memory_order_relaxed);
+    t->watch.lastBytes = -1;
+    t->watch.expired = nullptr;
+    t->watch.probed = 0;
+    t->errbuf[0] = 0;
+    return true;
+  }
+
+  // Engine thread: a duplicate of a running transfer on a fresh connection,
+  // and through another pooled proxy when there is one.
+  Transfer* HedgeTransfer(Transfer* t) {
+    CURL* dup = curl_easy_duphandle(t->curl);
+    if (!dup) return nullptr;
+    Transfer* x = new Transfer();
+    x->curl = dup;
+    x->id = t->id;
+    x->host = t->host;
+    x->proxy = t->proxy;
+    x->sharedHeaders = t->sharedHeaders;
+    x->sharedResolve = t->sharedResolve;
+    x->watch = t->watch;
+    x->watch.curl = dup;
+    x->watch.start = nowMs();
+    x->watch.lastBytes = -1;
+    x->watch.expired = nullptr;
+    x->watch.probed = 0;
+    curl_easy_setopt(dup, CURLOPT_PRIVATE, x);
+    curl_easy_setopt(dup, CURLOPT_ERRORBUFFER, x->errbuf);
+    curl_easy_setopt(dup, CURLOPT_WRITEDATA, x);
+    curl_easy_setopt(dup, CURLOPT_HEADERDATA, x);
+    curl_easy_setopt(dup, CURLOPT_PREREQDATA, x);
+    curl_easy_setopt(dup, CURLOPT_XFERINFODATA, &x->watch);
+    curl_easy_setopt(dup, CURLOPT_FRESH_CONNECT, 1L);
+    // Neither the share nor the in-memory cookies carry over.
+    if (share) curl_easy_setopt(dup, CURLOPT_SHARE, share);
+    curl_easy_setopt(dup, CURLOPT_COOKIEFILE, "");
+    for (const auto& c : t->hedgeJar) curl_easy_setopt(dup, CURLOPT_COOKIELIST, c.c_str());
+    if (t->proxyIdx >= 0) {
+      std::vector<int> tried = t->triedProxies;
+      tried.push_back(t->proxyIdx);
+      x->proxyIdx = proxyPool.acquire(t->sessionId, tried);
+      if (x->proxyIdx >= 0) {
+        x->proxy = proxyPool.url(x->proxyIdx);
+        curl_easy_setopt(dup, CURLOPT_PROXY, x->proxy.c_str());
       }
+    }
+    if (traceRing) traceRing->push(t->id, kTraceInfo, "hedge via " + (x->proxy.empty() ? std::string("fresh connection") : redactProxy(x->proxy)));
+    return x;
+  }
+
+  // Engine thread: return the pooled proxy of a transfer that will not be
+  // retried, a hedge racer or a dropped one. Only a proxy-side failure
+  // counts against it.
+  void DiscardTransfer(Transfer* x) {
+    if (x->proxyIdx < 0) return;
+    bool failed = !x->cancelled && x->rc != CURLE_OK && isProxyFailure(x->curl, x->rc);
+    proxyPool.release(x->proxyIdx, !failed, 0);
+    x->proxyIdx = -1;
+  }
+
+  // Engine thread: read everything settle needs off the handle.
+  void FinishTransfer(Transfer* t) {
+    CURL* curl = t->curl;
+    if (t->wantTimings || metricsEnabled) collectTimings(curl, t->tm);
+    t->finalUrl = t->url;
+    if (t->rc == CURLE_OK) {
+      char* effUrl = nullptr;
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &t->status);
+      curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effUrl);
+      if (effUrl) t->finalUrl = effUrl;
+      if (traceRing) traceRing->push(t->id, kTraceResponse, std::to_string(t->status) + " " + t->finalUrl);
 
-      // Sync cookies back to jar
       struct curl_slist *cookies = NULL;
       curl_easy_getinfo(curl, CURLINFO_COOKIELIST, &cookies);
       if (cookies) {
-        cookieJar.clear();
         struct curl_slist *nc = cookies;
         while (nc) {
-          cookieJar.push_back(nc->data);
+          t->cookies.push_back(nc->data);
           nc = nc->next;
         }
         curl_slist_free_all(cookies);
       }
     }
-    if (chunk) curl_slist_free_all(chunk);
-    if (dohResolve) curl_slist_free_all(dohResolve);
-    curl_easy_cleanup(curl);
+    if (breakers) RecordBreakers(t);
+    CURLNAPI_PROBE5(request__done, t->id, t->host.c_str(), (int)t->rc, t->status, t->respBody.size());
+    if (metricsEnabled) metrics.record(t->origin, t->proxy, t->tm, t->rc, t->status, (uint32_t)t->triedProxies.size());
+    if (t->localIdx >= 0) localAddressPool.release(t->localIdx);
+    // Dropped transfers (cancel, abort, group end) never reach the retry
+    // hook, which is what normally hands the pooled proxy back.
+    if (t->proxyIdx >= 0) DiscardTransfer(t);
+  }
 
-    if (rc != CURLE_OK) {
-      closeFn.Call({});
-      deferred.Reject(Napi::Error::New(env, curl_easy_strerror(rc)).Value());
-      return deferred.Promise();
-    }
-
-    Napi::Object resp = Napi::Object::New(env);
-    resp.Set("status", Napi::Number::New(env, status));
-    resp.Set("status_text", Napi::String::New(env, "")); // Simplified
-    resp.Set("ok", Napi::Boolean::New(env, status >= 200 && status < 300));
-    resp.Set("url", Napi::String::New(env, effUrl ? std::string(effUrl) : url));
-    // headers: array of [key,value]
-    Napi::Array hArr = Napi::Array::New(env, hc.headers.size());
-    for (size_t i=0;i<hc.headers.size();++i) {
-      Napi::Array pair = Napi::Array::New(env, 2);
-      pair.Set((uint32_t)0, Napi::String::New(env, hc.headers[i].first));
-      pair.Set((uint32_t)1, Napi::String::New(env, hc.headers[i].second));
-      hArr.Set((uint32_t)i, pair);
-    }
-    resp.Set("headers", hArr);
-    resp.Set("_body", Napi::String::New(env, respBody));
-    resp.Set("text", Napi::Function::New(env, [](const Napi::CallbackInfo& info){
-      Napi::Env env = info.Env();
-      Napi::Object self = info.This().As<Napi::Object>();
-      std::string body = self.Get("_body").As<Napi::String>().Utf8Value();
-      auto d = Napi::Promise::Deferred::New(env);
-      d.Resolve(Napi::String::New(env, body));
-      return d.Promise();
-    }));
-    resp.Set("json", Napi::Function::New(env, [](const Napi::CallbackInfo& info){
-      Napi::Env env = info.Env();
-      Napi::Object self = info.This().As<Napi::Object>();
-      std::string body = self.Get("_body").As<Napi::String>().Utf8Value();
-      auto d = Napi::Promise::Deferred::New(env);
+  // Engine thread. A proxy-side failure counts against the proxy only.
+  void RecordBreakers(Transfer* t) {
+    CircuitBreakers::Outcome origin = CircuitBreakers::kSuccess, proxy = CircuitBreakers::kSuccess;
+    if (t->cancelled) {
+      origin = proxy = CircuitBreakers::kNeutral;
+    } else if (t->rc != CURLE_OK) {
+      bool proxyFault = !t->proxy.empty() && isProxyFailure(t->curl, t->rc);
+      proxy = proxyFault ? CircuitBreakers::kFailure : CircuitBreakers::kNeutral;
+      origin = proxyFault ? CircuitBreakers::kNeutral : isConnectFailure(t->rc) ? CircuitBreakers::kFailure : CircuitBreakers::kNeutral;
+    }
+    originBreakers.record(t->origin, t->originProbe, origin, t->rc);
+    if (!t->pooledProxy && !t->proxy.empty()) proxyBreakers.record(redactProxy(t->proxy), t->proxyProbe, proxy, t->rc);
+  }
+
+  // One call settles a whole batch. A throwing callback does not strand the
+  // rest; the first exception is rethrown once the batch is done.
+  void SettleTransfers(Napi::Env env) {
+    bool more = false;
+    std::optional<Napi::Error> thrown;
+    for (Transfer* raw : engine.take(more)) {
+      std::unique_ptr<Transfer> t(raw);
+      Napi::HandleScope scope(env);
       try {
-        Napi::Value parsed = Napi::Env(env).Global().Get("JSON").As<Napi::Object>().Get("parse").As<Napi::Function>().Call({ Napi::String::New(env, body) });
-        d.Resolve(parsed);
-      } catch(const Napi::Error& e) {
-        d.Reject(e.Value());
-      } catch(...) {
-        d.Reject(Napi::Error::New(env, "Invalid JSON").Value());
+        Settle(env, *t);
+      } catch (const Napi::Error& e) {
+        if (!thrown) thrown = e;
       }
-      return d.Promise();
-    }));
-    resp.Set("bytes", Napi::Function::New(env, [](const Napi::CallbackInfo& info){
-      Napi::Env env = info.Env();
-      Napi::Object self = info.This().As<Napi::Object>();
-      std::string body = self.Get("_body").As<Napi::String>().Utf8Value();
-      auto d = Napi::Promise::Deferred::New(env);
-      d.Resolve(Napi::Buffer<uint8_t>::Copy(env, reinterpret_cast<const uint8_t*>(body.data()), body.size()));
-      return d.Promise();
-    }));
-    resp.Set("body", jsStream);
-    resp.Set("abort", Napi::Function::New(env, [](const Napi::CallbackInfo& info){
-      return info.Env().Undefined();
-    }));
-    closeFn.Call({});
+      if (--inflight == 0) {
+        settleFn.Unref(env);
+        Unref();
+      }
+    }
+    // Leftovers beyond the batch limit wait for the next loop turn.
+    if (more) settleFn.NonBlockingCall([this](Napi::Env env, Napi::Function) { SettleTransfers(env); });
+    if (thrown) throw *thrown;
+  }
+
+  void Settle(Napi::Env env, Transfer& t) {
+    uint64_t requestId = t.id;
+    // Sync cookies back to jar
+    if (!t.cookies.empty()) (t.jar ? *t.jar : cookieJar).swap(t.cookies);
+    Napi::Object signal;
+    if (!t.signal.IsEmpty()) {
+      signal = t.signal.Value();
+      signal.Get("removeEventListener").As<Napi::Function>().Call(signal, { Napi::String::New(env, "abort"), t.onAbort.Value() });
+    }
+
+    if (t.cancelled && !signal.IsEmpty() && signal.Get("aborted").ToBoolean().Value()) {
+      Deliver(env, t, signal.Get("reason"), false);
+      return;
+    }
+    if (t.rc != CURLE_OK) {
+      const char* groupEnd = t.group ? t.group->reason.load() : nullptr;
+      Napi::Error err = groupEnd ? groupError(env, groupEnd) : t.cancelled ? abortError(env) : transferError(env, t.rc, t.errbuf, t.watch);
+      if (t.wantTimings) err.Value().Set("timings", timingsToObject(env, t.tm));
+      if (traceRing) {
+        traceRing->push(requestId, kTraceError, err.Message());
+        err.Value().Set("trace", traceRing->dump(env, requestId));
+      }
+      Deliver(env, t, err.Value(), false);
+      return;
+    }
+
+    Napi::Object resp = ImpitResponse::Create(env, t);
+    CURLNAPI_PROBE3(js__resolve, requestId, t.host.c_str(), t.status);
+    Deliver(env, t, resp, true);
+  }
 
-    deferred.Resolve(resp);
-    return deferred.Promise();
+  // Settles a fetch() promise or callback, or files the result with its
+  // fetchMany() batch.
+  void Deliver(Napi::Env env, Transfer& t, Napi::Value v, bool ok) {
+    if (t.deferred) {
+      if (ok) t.deferred->Resolve(v);
+      else t.deferred->Reject(v);
+      return;
+    }
+    if (!t.callback.IsEmpty()) {
+      if (ok) t.callback.Call({ env.Null(), v });
+      else t.callback.Call({ v });
+      return;
+    }
+    Batch& b = *t.batch;
+    b.remaining--;
+    if (b.remaining == 0 && !b.signal.IsEmpty() && !b.onAbort.IsEmpty()) {
+      Napi::Object signal = b.signal.Value();
+      signal.Get("removeEventListener").As<Napi::Function>().Call(signal, { Napi::String::New(env, "abort"), b.onAbort.Value() });
+    }
+    if (b.closed) return;
+    Napi::Object item = Napi::Object::New(env);
+    item.Set("index", Napi::Number::New(env, t.index));
+    item.Set(ok ? "response" : "error", v);
+    if (!b.waiters.empty()) {
+      b.waiters.front().Resolve(iterResult(env, item, false));
+      b.waiters.pop_front();
+    } else {
+      b.ready.push_back(Napi::Persistent(item));
+    }
+    if (b.remaining == 0) {
+      for (auto& w : b.waiters) w.Resolve(iterResult(env, env.Undefined(), true));
+      b.waiters.clear();
+    }
   }
 
   Napi::Value GetCookies(const Napi::CallbackInfo& info) {
@@ -595,6 +4669,163 @@ public:
     return arr;
   }
 
+  Napi::Value ProxyStats(const Napi::CallbackInfo& info) {
+    return proxyPool.stats(info.Env());
+  }
+
+  // metrics() returns a JSON-ready snapshot, metrics("prometheus") the
+  // text exposition format.
+  Napi::Value Metrics(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    uint64_t fired = engine.hedgesFired.load(), won = engine.hedgesWon.load(), denied = engine.hedgesDenied.load();
+    if (info.Length() >= 1 && info[0].IsString() && info[0].As<Napi::String>().Utf8Value() == "prometheus") {
+      std::string out = metrics.prometheus();
+      out += "# HELP curlnapi_hedges_total Hedged requests by outcome.\n# TYPE curlnapi_hedges_total counter\n";
+      out += "curlnapi_hedges_total{result=\"fired\"} " + std::to_string(fired) + "\n";
+      out += "curlnapi_hedges_total{result=\"won\"} " + std::to_string(won) + "\n";
+      out += "curlnapi_hedges_total{result=\"denied\"} " + std::to_string(denied) + "\n";
+      return Napi::String::New(env, out);
+    }
+    Napi::Object snap = metrics.snapshot(env);
+    Napi::Object hedges = Napi::Object::New(env);
+    hedges.Set("fired", Napi::Number::New(env, (double)fired));
+    hedges.Set("won", Napi::Number::New(env, (double)won));
+    hedges.Set("denied", Napi::Number::New(env, (double)denied));
+    snap.Set("hedges", hedges);
+    return snap;
+  }
+
+  Napi::Value DrainTrace(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!traceRing) return Napi::Array::New(env);
+    return traceRing->drain(env);
+  }
+
+  // dumpTrace(requestId?) reads the flight recorder without consuming it.
+  Napi::Value DumpTrace(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!traceRing) return Napi::Array::New(env);
+    uint64_t id = info.Length() >= 1 && info[0].IsNumber() ? (uint64_t)info[0].As<Napi::Number>().Int64Value() : 0;
+    return traceRing->dump(env, id);
+  }
+
+  // inflight() lists every transfer the engine holds, read from the state it
+  // publishes as it goes; running transfers are not paused.
+  Napi::Value Inflight(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Array arr = Napi::Array::New(env);
+    int64_t now = nowMs();
+    uint32_t i = 0;
+    engine.forEach([&](Transfer& t) {
+      Napi::Object o = Napi::Object::New(env);
+      int64_t conn = t.connectionId.load(std::memory_order_relaxed);
+      o.Set("id", Napi::Number::New(env, (double)t.id));
+      o.Set("url", Napi::String::New(env, t.url));
+      o.Set("method", Napi::String::New(env, t.method));
+      o.Set("phase", Napi::String::New(env, kXferPhaseNames[t.phase.load(std::memory_order_relaxed)]));
+      o.Set("elapsed", Napi::Number::New(env, (double)(now - t.submitted)));
+      o.Set("bytes", Napi::Number::New(env, (double)t.bytesDown.load(std::memory_order_relaxed)));
+      o.Set("proxy", t.proxy.empty() ? env.Null() : Napi::String::New(env, redactProxy(t.proxy)));
+      o.Set("connectionId", conn < 0 ? env.Null() : Napi::Number::New(env, (double)conn));
+      o.Set("retries", Napi::Number::New(env, (double)t.triedProxies.size()));
+      arr.Set(i++, o);
+    });
+    return arr;
+  }
+
+  // cancel(id) rejects the fetch with an AbortError and frees its slot.
+  Napi::Value Cancel(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsNumber()) {
+      throw Napi::TypeError::New(env, "Expected a request id");
+    }
+    return Napi::Boolean::New(env, engine.cancel((uint64_t)info[0].As<Napi::Number>().Int64Value()));
+  }
+
+  // cancelWhere(predicate) runs the predicate over an inflight() snapshot
+  // and cancels the matches, returning how many were cancelled.
+  Napi::Value CancelWhere(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsFunction()) {
+      throw Napi::TypeError::New(env, "Expected a predicate function");
+    }
+    Napi::Function pred = info[0].As<Napi::Function>();
+    Napi::Array list = Inflight(info).As<Napi::Array>();
+    uint32_t cancelled = 0;
+    for (uint32_t i = 0; i < list.Length(); ++i) {
+      Napi::Object o = list.Get(i).As<Napi::Object>();
+      if (!pred.Call({ o }).ToBoolean().Value()) continue;
+      if (engine.cancel((uint64_t)o.Get("id").As<Napi::Number>().Int64Value())) cancelled++;
+    }
+    return Napi::Number::New(env, cancelled);
+  }
+
+  // group({ maxConcurrency, maxBytes, deadline }) returns a handle that
+  // fetch() accepts as init.group. deadline is in ms from now.
+  Napi::Value Group(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    auto g = std::make_shared<RequestGroup>();
+    g->id = ++nextGroupId;
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Object o = info[0].As<Napi::Object>();
+      if (o.Has("maxConcurrency") && o.Get("maxConcurrency").IsNumber()) g->maxConcurrency = o.Get("maxConcurrency").As<Napi::Number>().Uint32Value();
+      if (o.Has("maxBytes") && o.Get("maxBytes").IsNumber()) g->maxBytes = (uint64_t)o.Get("maxBytes").As<Napi::Number>().Int64Value();
+      if (o.Has("deadline") && o.Get("deadline").IsNumber()) g->deadline = nowMs() + o.Get("deadline").As<Napi::Number>().Int64Value();
+    }
+    for (auto it = groups.begin(); it != groups.end();) {
+      if (it->second.expired()) it = groups.erase(it);
+      else ++it;
+    }
+    groups[g->id] = g;
+    // The handle owns the group; members keep it alive until they settle.
+    // cancel() holds the client, so it stays callable after the client's
+    // last other reference is gone.
+    Napi::Object handle = Napi::Object::New(env);
+    handle.Set("id", Napi::Number::New(env, (double)g->id));
+    auto client = std::make_shared<Napi::ObjectReference>(Napi::Persistent(Value()));
+    handle.Set("cancel", Napi::Function::New(env, [this, client, g](const Napi::CallbackInfo& info) {
+      engine.cancelGroup(g, "cancelled");
+      return info.Env().Undefined();
+    }));
+    handle.Set("stats", Napi::Function::New(env, [g](const Napi::CallbackInfo& info) {
+      Napi::Env env = info.Env();
+      Napi::Object o = Napi::Object::New(env);
+      const char* reason = g->reason.load();
+      o.Set("active", Napi::Number::New(env, g->active.load()));
+      o.Set("queued", Napi::Number::New(env, g->queued.load()));
+      o.Set("completed", Napi::Number::New(env, (double)g->completed.load()));
+      o.Set("failed", Napi::Number::New(env, (double)g->failed.load()));
+      o.Set("bytes", Napi::Number::New(env, (double)g->bytes.load()));
+      o.Set("ended", reason ? Napi::String::New(env, reason) : env.Null());
+      o.Set("latency", summarizeMs(env, g->latency));
+      return o;
+    }));
+    return handle;
+  }
+
+  // adaptiveLimits() returns { origin: { limit, p90 } }; passing it back as
+  // scheduler.adaptive.limits resumes from the learned values.
+  Napi::Value AdaptiveLimits(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Object out = Napi::Object::New(env);
+    for (auto& kv : engine.learnedLimits()) {
+      Napi::Object o = Napi::Object::New(env);
+      o.Set("limit", Napi::Number::New(env, kv.second.limit));
+      o.Set("p90", Napi::Number::New(env, kv.second.p90));
+      out.Set(kv.first, o);
+    }
+    return out;
+  }
+
+  // breakerStats() lists origins and fixed proxies with recent failures.
+  Napi::Value BreakerStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Object out = Napi::Object::New(env);
+    out.Set("origins", originBreakers.stats(env));
+    out.Set("proxies", proxyBreakers.stats(env));
+    return out;
+  }
+
   Napi::Value SetCookies(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     if (info.Length() < 1 || !info[0].IsArray()) {
@@ -614,34 +4845,53 @@ public:
 private:
   std::string browser;
   std::vector<std::string> cookieJar;
-  uint32_t timeoutMs{30000};
+  // Request options set on the client; every request starts from these.
+  RequestSpec defaults;
   bool verify{true};
   std::string caPath;
   bool followRedirects{true};
   std::vector<std::pair<std::string,std::string>> defaultHeaders;
-  std::string proxyUrl;
-  std::string proxyUsername;
-  std::string proxyPassword;
-  std::string noProxy;
-  bool ignoreProxyTlsErrors{false};
+  std::shared_ptr<curl_slist> defaultSlist;
   bool verbose{false};
-  uint32_t connectTimeoutMs{0};
-  uint32_t maxRedirects{0};
-  int httpVersion{0};
-  std::string ipResolve;
-  std::string dohUrl{"https://cloudflare-dns.com/dns-query"};
-  std::string dohResolveString;
-  bool ignoreDohTlsErrors{false};
-  std::string userAgent;
-  std::string referer;
-  std::string cookieJarPath;
-  std::string proxyType;
-  std::string proxyAuth;
+  uint32_t traceBufferSize{4096};
+  std::unique_ptr<TraceRing> traceRing;
+  std::atomic<uint64_t> nextRequestId{0};
+  ProxyPool proxyPool;
+  LocalAddressPool localAddressPool;
+  bool metricsEnabled{false};
+  MetricsRegistry metrics;
+  CURLSH* share{nullptr};
+  std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+  bool breakers{false};
+  CircuitBreakers originBreakers;
+  CircuitBreakers proxyBreakers;
+  std::map<uint64_t, std::weak_ptr<RequestGroup>> groups;
+  uint64_t nextGroupId{0};
+  std::set<std::shared_ptr<JobRun>> jobs;
+  Engine engine;
+  Napi::ThreadSafeFunction settleFn;
+  uint32_t inflight{0};
 };
 
+Napi::Value ImpitSession::Fetch(const Napi::CallbackInfo& info) { return parent->FetchFor(info, this); }
+
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
   curl_global_init(CURL_GLOBAL_DEFAULT);
+  AddonData* data = new AddonData();
+  Napi::Function response = ImpitResponse::InitClass(env);
+  data->responseCtor = Napi::Persistent(response);
+  Napi::Function headers = ImpitHeaders::InitClass(env);
+  data->headersCtor = Napi::Persistent(headers);
+  Napi::Function profile = ImpitProfile::InitClass(env);
+  data->profileCtor = Napi::Persistent(profile);
+  Napi::Function session = ImpitSession::InitClass(env);
+  data->sessionCtor = Napi::Persistent(session);
+  env.SetInstanceData(data);
   exports.Set("Impit", ImpitWrapper::InitClass(env));
+  exports.Set("ImpitResponse", response);
+  exports.Set("ImpitHeaders", headers);
+  exports.Set("ImpitProfile", profile);
+  exports.Set("ImpitSession", session);
   return exports;
 }
 
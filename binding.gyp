@@ -64,6 +64,9 @@
 #   ]
 # }
 {
+  "variables": {
+    "curlnapi_usdt%": 0
+  },
   "targets": [
     {
       "target_name": "curlnapi",
@@ -77,6 +80,9 @@
       "cflags!": ["-fno-exceptions"],
       "cflags_cc!": ["-fno-exceptions"],
       "conditions": [
+        ["curlnapi_usdt==1 and OS=='linux'", {
+          "defines": ["CURLNAPI_USDT"]
+        }],
         ["OS=='win'", {
           "libraries": [
             "-lCrypt32",
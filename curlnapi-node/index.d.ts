@@ -7,10 +7,83 @@ export type HttpMethod =
   | 'HEAD'
   | 'OPTIONS';
 
+export interface SocketOptions {
+  noDelay?: boolean;
+  fastOpen?: boolean;
+  keepAlive?: boolean;
+  /** Seconds before the first keepalive probe. */
+  keepIdle?: number;
+  /** Seconds between keepalive probes. */
+  keepInterval?: number;
+  keepCount?: number;
+  rcvBuf?: number;
+  sndBuf?: number;
+  /** Linux only. */
+  quickAck?: boolean;
+  /** Linux and macOS only. */
+  notSentLowat?: number;
+}
+
+/**
+ * Phase budgets in ms, each counted from the end of the previous phase.
+ * `idle` caps the gap between body chunks; `total` overrides `timeout`.
+ * Expiry rejects with an error whose `phase` names the deadline.
+ */
+export interface PhaseTimeouts {
+  dns?: number;
+  connect?: number;
+  tls?: number;
+  firstByte?: number;
+  idle?: number;
+  total?: number;
+}
+
+/** Phase times are cumulative ms since the request started. */
+export interface Timings {
+  dns: number;
+  connect: number;
+  tls: number;
+  pretransfer: number;
+  firstByte: number;
+  redirect: number;
+  total: number;
+  /** Both directions count headers as well as bodies. */
+  bytesUp: number;
+  bytesDown: number;
+  numConnects: number;
+  /** False when no connection was made at all, e.g. after a DNS error. */
+  reused: boolean;
+  httpVersion: '1.0' | '1.1' | '2' | '3' | '';
+  remoteIp: string;
+  remotePort: number;
+  localIp: string;
+  localPort: number;
+}
+
+/**
+ * Unknown keys, keys that only apply per request, and values of the wrong
+ * type throw a TypeError. `undefined` and `null` values are ignored.
+ */
 export interface ImpitOptions {
   timeout?: number;
+  timeouts?: PhaseTimeouts;
+  /** Abort when slower than `lowSpeedLimit` bytes/s for `lowSpeedTime` seconds. */
+  lowSpeedLimit?: number;
+  lowSpeedTime?: number;
+  /** Attach `timings` to responses and transfer errors. */
+  timings?: boolean;
+  /** Aggregate per-origin and per-proxy metrics, read via `metrics()`. */
+  metrics?: boolean;
+  /** Distinct origins/proxies tracked before lumping into "other". */
+  metricsMaxKeys?: number;
   followRedirects?: boolean;
+  /** Trace into the native ring buffer and print it to stderr in the background. */
   debug?: boolean;
+  verbose?: boolean;
+  /** Trace into the native ring buffer without printing; read via drainTrace(). */
+  trace?: boolean;
+  /** Ring buffer capacity in events, rounded up to a power of two. */
+  traceBufferSize?: number;
   browser?: string;
   proxyUrl?: string;
   userAgent?: string;
@@ -21,35 +94,409 @@ export interface ImpitOptions {
   dohUrl?: string;
   dohResolve?: string;
   ignoreTlsErrors?: boolean;
-  headers?: Record<string, string>;
+  /** Proxy pool; ignored for requests that pass their own `proxy`. */
+  proxies?: string[];
+  proxyRotation?: 'round-robin' | 'least-latency' | 'sticky';
+  /** Base ban after a connect failure, doubled per consecutive failure. */
+  proxyBanTime?: number;
+  /** How many other proxies to try after a connect failure. */
+  proxyMaxRetries?: number;
+  /**
+   * Source addresses to spread requests over: IPs, interface names, curl's
+   * "if!"/"host!" forms, or an IPv6 prefix such as "2001:db8::/64" which
+   * gives every host its own address inside the block.
+   */
+  localAddresses?: string[];
+  localAddressMode?: 'sticky' | 'round-robin';
+  /**
+   * Requests on one address before new ones spill to the least loaded
+   * address. A threshold, not a cap: requests never wait for an address.
+   */
+  localAddressSpillAt?: number;
+  socket?: SocketOptions;
+  /** Connect through a Unix domain socket instead of TCP. */
+  unixSocketPath?: string;
+  /** Linux abstract namespace socket name; wins over `unixSocketPath`. */
+  abstractUnixSocket?: string;
+  /** How finished requests are handed to JS; see CompletionOptions. */
+  completions?: CompletionOptions;
+  /** Fast-fail origins and fixed proxies after repeated connect failures or timeouts. */
+  circuitBreaker?: CircuitBreakerOptions;
+  /** Native per-origin queueing; requests wait in the engine, not in JS. */
+  scheduler?: SchedulerOptions;
+  /** Hedge idempotent requests by default; `true` uses the origin percentile as the delay. */
+  hedge?: boolean | HedgeOptions;
+  headers?: HeadersInput;
   cookieJar?: {
     setCookie?: (cookieStr: string, url: string) => Promise<any> | any;
     getCookieString?: (url: string) => Promise<string> | string;
   } | undefined;
 }
 
+/**
+ * Pairs, an object, a flat `[name, value, ...]` array, or a block from
+ * `encodeHeaders()`, which is parsed without touching JS objects.
+ */
+export type HeadersInput = Headers | ImpitHeaders | Record<string, string> | Array<[string, string]> | string[] | Buffer;
+
+/** Encodes headers once for reuse across many requests. */
+export function encodeHeaders(headers: HeadersInput): Buffer;
+
+/** Checked like ImpitOptions; client-only keys such as `proxies` are rejected. */
 export interface RequestInit {
   method?: HttpMethod;
-  headers?: Headers | Record<string, string> | Array<[string, string]>;
+  headers?: HeadersInput;
   body?: any;
   timeout?: number;
+  /** Aborting cancels the transfer natively and frees its connection. */
+  signal?: AbortSignal;
+  /** Key for `proxyRotation: 'sticky'`. */
+  sessionId?: string;
+  /** Source address for this request, bypassing `localAddresses`. */
+  localAddress?: string;
+  /** Merged over the client's `socket` options. */
+  socket?: SocketOptions;
+  unixSocketPath?: string;
+  abstractUnixSocket?: string;
+  timeouts?: PhaseTimeouts;
+  lowSpeedLimit?: number;
+  lowSpeedTime?: number;
+  timings?: boolean;
+  group?: RequestGroup;
+  /** Scheduler lane; interactive requests are always dispatched first. Default 'interactive'. */
+  priority?: 'interactive' | 'bulk';
+  /**
+   * Send a duplicate on a fresh connection if no response has started after
+   * the delay; the first to finish wins. A number is the delay in ms, `true`
+   * uses the client policy. Ignored for non-idempotent methods. A duplicate
+   * shares the origin's bytesPerSecond budget and counts against its
+   * group's maxConcurrency and maxBytes; it is skipped when the group is full.
+   */
+  hedge?: boolean | number | { delay?: number };
 }
 
-export interface ImpitResponse {
-  status: number;
+export interface HedgeOptions {
+  /** Fixed delay in ms; 0 derives it from the origin's latency percentile. */
+  delay?: number;
+  /** Default 0.95. */
+  percentile?: number;
+  /** Hedges allowed per completed request. Default 0.1. */
+  budget?: number;
+}
+
+export interface BatchRequest {
   url: string;
-  headers: Headers | Array<[string, string]>;
+  method?: HttpMethod;
+  headers?: Record<string, string> | Array<[string, string]> | string[] | Buffer;
+  body?: string | Buffer;
+}
+
+/** Shared by every request of the batch; parsed once. */
+export interface FetchManyOptions extends Omit<RequestInit, 'body' | 'group'> {
+  /** Requests in flight at once, enforced natively. */
+  concurrency?: number;
+}
+
+/** Failures are yielded, not thrown, so one error does not end the batch. */
+export type BatchResult =
+  | { index: number; response: ImpitResponse; error?: undefined }
+  | { index: number; error: Error; response?: undefined };
+
+/**
+ * Shared by every line of the job. Lines are URL strings or objects with
+ * url, method, headers, body, timeout, sessionId, proxy and an `id` echoed
+ * into the result.
+ */
+export interface JobOptions extends Omit<RequestInit, 'body'> {
+  /** Default 16. */
+  concurrency?: number;
+  /**
+   * 'inline' (default) embeds the body, base64 when not UTF-8; 'file' writes
+   * it under `bodyDir` and records the path; 'hash' records only size and hash.
+   */
+  body?: 'inline' | 'file' | 'hash' | 'none';
+  /** Default `${outPath}.bodies`. */
+  bodyDir?: string;
+}
+
+export interface JobSummary {
+  succeeded: number;
+  failed: number;
+  /** Lines already done by an earlier run. */
+  skipped: number;
+  /** Input line the run started from. */
+  resumedAt: number;
+  /** False when stopped by `signal`; rerun to resume. */
+  complete: boolean;
+}
+
+/**
+ * Completions that land close together are settled by a single native
+ * callback on the event loop.
+ */
+export interface CompletionOptions {
+  /** Most settled per callback; the rest go in the next loop turn. Default unlimited. */
+  maxBatch?: number;
+  /** ms to hold a completion back while more arrive. Default 0. */
+  maxDelay?: number;
+}
+
+export interface OriginLimits {
+  maxPerOrigin?: number;
+  requestsPerSecond?: number;
+  /** Response body bytes per second; transfers are paused when exceeded. */
+  bytesPerSecond?: number;
+  /** Request bucket size. Default one second's worth. */
+  burst?: number;
+}
+
+export interface AdaptiveOptions {
+  min?: number;
+  /** Default 256, further capped by maxPerOrigin. */
+  max?: number;
+  initial?: number;
+  /** Added per healthy window of completions. Default 1. */
+  increase?: number;
+  /** Multiplier on 429/503, timeouts or a latency spike. Default 0.5. */
+  decrease?: number;
+  /** p90 above baseline * latencyFactor counts as a spike. Default 2. */
+  latencyFactor?: number;
+  /** Limits from a previous adaptiveLimits() call. */
+  limits?: Record<string, AdaptiveLimit | number>;
+}
+
+export interface AdaptiveLimit {
+  limit: number;
+  /** Baseline p90 latency in ms. */
+  p90: number;
+}
+
+export interface SchedulerOptions extends OriginLimits {
+  /** Overrides keyed by origin, e.g. 'https://example.com'. */
+  origins?: Record<string, OriginLimits>;
+  /** Learn each origin's concurrency with AIMD. */
+  adaptive?: boolean | AdaptiveOptions;
+}
+
+export interface GroupOptions {
+  maxConcurrency?: number;
+  /** Response body bytes across all members. */
+  maxBytes?: number;
+  /** ms from creation. */
+  deadline?: number;
+}
+
+export interface GroupStats {
+  active: number;
+  queued: number;
+  completed: number;
+  failed: number;
+  bytes: number;
+  /** Why the group was torn down, or null while it is open. */
+  ended: 'cancelled' | 'maxBytes' | 'deadline' | null;
+  latency: PhaseSummary;
+}
+
+export interface RequestGroup {
+  readonly id: number;
+  fetch(url: string, init?: RequestInit): Promise<ImpitResponse>;
+  /** Rejects every queued and running member at once. */
+  cancel(): void;
+  stats(): GroupStats;
+}
+
+export interface CircuitBreakerOptions {
+  /** Consecutive connect failures or timeouts that open the breaker. Default 5. */
+  threshold?: number;
+  /** ms the breaker stays open before letting probes through. Default 30000. */
+  resetTimeout?: number;
+  /** Concurrent probe requests while half-open. Default 1. */
+  halfOpenProbes?: number;
+}
+
+export interface BreakerState {
+  state: 'closed' | 'open' | 'halfOpen';
+  failures: number;
+  retryInMs: number;
+  lastError: string;
+}
+
+export interface ProxyStats {
+  url: string;
+  successes: number;
+  failures: number;
+  inflight: number;
+  latencyMs: number;
+  score: number;
+  banned: boolean;
+  bannedForMs: number;
+}
+
+/** Latencies in ms; percentiles are bucket upper bounds (~12% resolution). */
+export interface PhaseSummary {
+  count: number;
+  mean: number;
+  p50: number;
+  p90: number;
+  p99: number;
+  max: number;
+}
+
+export interface EndpointMetrics {
+  requests: number;
+  retries: number;
+  bytesUp: number;
+  bytesDown: number;
+  reuseRatio: number;
+  status: Record<'1xx' | '2xx' | '3xx' | '4xx' | '5xx', number>;
+  /** Keyed by curl error code. */
+  errors: Record<string, number>;
+  phases: Record<'dns' | 'connect' | 'tls' | 'firstByte' | 'total', PhaseSummary>;
+}
+
+export interface MetricsSnapshot {
+  origins: Record<string, EndpointMetrics>;
+  proxies: Record<string, EndpointMetrics>;
+  hedges: { fired: number; won: number; denied: number };
+}
+
+export interface TraceEvent {
+  seq: number;
+  /** Epoch ms. */
+  time: number;
+  requestId: number;
+  type: 'request' | 'info' | 'connect' | 'reuse' | 'tls' | 'headerOut' | 'headerIn' | 'response' | 'error';
+  text: string;
+}
+
+export interface InflightRequest {
+  id: number;
+  url: string;
+  method: string;
+  phase: 'queued' | 'connecting' | 'waiting' | 'headers' | 'body';
+  /** ms since fetch() was called. */
+  elapsed: number;
+  /** Body bytes received so far. */
+  bytes: number;
+  proxy: string | null;
+  connectionId: number | null;
+  retries: number;
+}
+
+/** Read-only response headers backed by native memory. */
+export interface ImpitHeaders {
+  /** Case-insensitive; repeated fields are joined with ", ". */
+  get(name: string): string | null;
+  has(name: string): boolean;
+  getSetCookie(): string[];
+  entries(): IterableIterator<[string, string]>;
+  keys(): IterableIterator<string>;
+  values(): IterableIterator<string>;
+  forEach(callback: (value: string, name: string, headers: ImpitHeaders) => void, thisArg?: any): void;
+  [Symbol.iterator](): IterableIterator<[string, string]>;
+}
+
+export const ImpitHeaders: { prototype: ImpitHeaders };
+
+/**
+ * Body readers can be used once; bodyUsed turns true after the first, and
+ * clone() must be called before it.
+ */
+export interface ImpitResponse {
+  readonly status: number;
+  /** Reason phrase from the status line; empty over HTTP/2 and HTTP/3. */
+  readonly statusText: string;
+  /** "1.0", "1.1", "2" or "3". */
+  readonly httpVersion: string;
+  readonly ok: boolean;
+  readonly url: string;
+  readonly headers: ImpitHeaders;
+  readonly timings?: Timings;
+  readonly bodyUsed: boolean;
   text(): Promise<string>;
   json(): Promise<any>;
   bytes(): Promise<Uint8Array>;
-  body: ReadableStream<any>;
-  abort(): void;
+  arrayBuffer(): Promise<ArrayBuffer>;
+  /** Created on first access. */
+  readonly body: ReadableStream<Uint8Array>;
+  clone(): ImpitResponse;
+  /** Drops the buffered body and errors `body` if it has not been read. */
+  abort(reason?: any): void;
 }
 
+/** An init frozen by `compileProfile()`; only usable with the client that made it. */
+export interface ImpitProfile {}
+
+export const ImpitProfile: { prototype: ImpitProfile };
+
+/** Per-request keys such as `method`, `body` or `signal` are rejected. */
+export interface SessionOptions extends Omit<RequestInit, 'method' | 'body' | 'signal' | 'group' | 'priority'> {
+  proxy?: string;
+  userAgent?: string;
+  referer?: string;
+  /** Initial cookie store, in the format `getCookies()` returns. */
+  cookies?: string[];
+}
+
+/**
+ * A cheap child of an Impit client with its own options and cookie store.
+ * It holds a full copy of the client's defaults. Requests share the parent's engine, connection
+ * pool and DNS/TLS caches.
+ */
+export interface ImpitSession {
+  fetch(url: string, init?: RequestInit): Promise<ImpitResponse>;
+  getCookies(): string[];
+  setCookies(cookies: string[]): void;
+}
+
+export const ImpitSession: { prototype: ImpitSession };
+
 export class Impit {
   constructor(options?: ImpitOptions);
-  fetch(url: string, init?: RequestInit): Promise<ImpitResponse>;
+  /** With a profile, nothing is parsed per call and `cookieJar` hooks are not consulted. */
+  fetch(url: string, init?: RequestInit | ImpitProfile): Promise<ImpitResponse>;
+  /** Validates `init` once and prebuilds its header and resolve lists. */
+  compileProfile(init?: Omit<RequestInit, 'signal'>): ImpitProfile;
+  session(options?: SessionOptions): ImpitSession;
+  /**
+   * Promise-free fetch. Returns the request id and calls back from the
+   * completion batch. Errors found before submission are thrown. `body` must
+   * be a string or Buffer.
+   */
+  fetchCallback(url: string, init: RequestInit | ImpitProfile | undefined, callback: (err: Error | null, res?: ImpitResponse) => void): number;
+  fetchCallback(url: string, callback: (err: Error | null, res?: ImpitResponse) => void): number;
+  proxyStats(): ProxyStats[];
+  metrics(): MetricsSnapshot;
+  metrics(format: 'prometheus'): string;
+  /** Trace events since the previous drain. */
+  drainTrace(): TraceEvent[];
+  /** Buffered trace events without consuming them, optionally for one request. */
+  dumpTrace(requestId?: number): TraceEvent[];
+  /**
+   * Submits every request in one native call and yields results in completion
+   * order. Breaking out of the loop cancels the rest. `cookieJar` hooks are
+   * not consulted.
+   */
+  fetchMany(requests: Array<string | BatchRequest>, options?: FetchManyOptions): AsyncIterableIterator<BatchResult>;
+  /**
+   * Runs an NDJSON file of requests natively and appends one result line per
+   * request to `outPath`. Progress is checkpointed to `${outPath}.checkpoint`.
+   */
+  runJobFile(inPath: string, outPath: string, options?: JobOptions): Promise<JobSummary>;
+  inflight(): InflightRequest[];
+  /** Rejects the request with an AbortError; false if it already finished. */
+  cancel(id: number): boolean;
+  /** Returns the number of requests cancelled. */
+  cancelWhere(predicate: (req: InflightRequest) => boolean): number;
+  group(options?: GroupOptions): RequestGroup;
+  /** Learned per-origin limits, keyed by origin. */
+  adaptiveLimits(): Record<string, AdaptiveLimit>;
+  /**
+   * Breakers with recent failures. While open, fetch() rejects at once with
+   * a CircuitOpenError (code 'ECIRCUITOPEN').
+   */
+  breakerStats(): { origins: Record<string, BreakerState>; proxies: Record<string, BreakerState> };
 }
 
 export const ImpitWrapper: typeof Impit;
-export const ImpitResponse: any;
+export const ImpitResponse: { prototype: ImpitResponse };
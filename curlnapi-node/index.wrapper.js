@@ -6,15 +6,39 @@ try {
   throw new Error(`curlnapi-node couldn't load native bindings. Set VERBOSE=1 for details.`, process.env['VERBOSE'] === '1' ? { cause: e } : undefined)
 }
 
+// Per-request options the native fetch understands, forwarded untouched.
+const NATIVE_INIT_KEYS = ['sessionId', 'localAddress', 'socket', 'unixSocketPath', 'abstractUnixSocket', 'timeouts', 'lowSpeedLimit', 'lowSpeedTime', 'timings', 'group', 'priority', 'hedge']
+
 function canonicalizeHeaders(headers) {
+  if (Buffer.isBuffer(headers)) return headers
   if (typeof Headers !== 'undefined' && headers instanceof Headers) return [...headers.entries()]
+  if (headers instanceof native.ImpitHeaders) return [...headers.entries()]
   if (Array.isArray(headers)) return headers
   if (headers && typeof headers === 'object') return Object.entries(headers)
   return []
 }
 
+// Headers are pairs or an encoded block from here on.
+function hasHeader(headers, name) {
+  if (Buffer.isBuffer(headers)) return new RegExp(`^${name}[ \\t]*:`, 'im').test(headers.toString('latin1'))
+  return headers.some(([k]) => String(k).toLowerCase() === name)
+}
+
+function withHeader(headers, name, value) {
+  if (Buffer.isBuffer(headers)) return Buffer.concat([headers, Buffer.from(`${name}: ${value}\r\n`)])
+  return [...headers, [name, value]]
+}
+
+// Encodes headers once as a "Name: value" block that can be passed as
+// `headers` to any number of requests without re-marshalling them.
+function encodeHeaders(headers) {
+  if (Buffer.isBuffer(headers)) return headers
+  return Buffer.from(canonicalizeHeaders(headers).map(([k, v]) => `${k}: ${v}\r\n`).join(''))
+}
+
 function headersToObject(headers) {
   if (!headers) return undefined
+  if (Buffer.isBuffer(headers)) return headers
   const entries = canonicalizeHeaders(headers)
   return Object.fromEntries(entries)
 }
@@ -30,12 +54,12 @@ async function parseFetchOptions(resource, init) {
   } else {
     url = resource
   }
-  const headerEntries = canonicalizeHeaders(options?.headers)
+  let headerEntries = canonicalizeHeaders(options?.headers)
   if (options?.body) {
     const { body, type } = await castToTypedArray(options.body)
     options.body = body
-    if (type && !headerEntries.some(([k]) => String(k).toLowerCase() === 'content-type')) {
-      headerEntries.push(['Content-Type', type])
+    if (type && !hasHeader(headerEntries, 'content-type')) {
+      headerEntries = withHeader(headerEntries, 'Content-Type', type)
     }
   } else {
     delete options.body
@@ -43,51 +67,96 @@ async function parseFetchOptions(resource, init) {
   const out = {
     url,
     method: options.method,
-    headers: Object.fromEntries(headerEntries),
+    headers: headerEntries,
     body: options.body,
     signal: options.signal,
   }
   if (typeof options.timeout === 'number') out.timeout = options.timeout
+  for (const key of NATIVE_INIT_KEYS) {
+    if (options[key] !== undefined) out[key] = options[key]
+  }
   return out
 }
 
+const TRACE_MARKERS = { request: '>>', headerOut: '>', headerIn: '<', response: '<<', error: '!!' }
+
+// verbose/debug print the native trace off the request path. The timer only
+// holds a weak reference so it never keeps a client alive.
+function startTracePrinter(client) {
+  const ref = new WeakRef(client)
+  const timer = setInterval(() => {
+    const self = ref.deref()
+    if (!self) return clearInterval(timer)
+    const events = self.drainTrace()
+    if (!events.length) return
+    process.stderr.write(events.map((ev) => `[curlnapi] #${ev.requestId} ${TRACE_MARKERS[ev.type] || '*'} ${ev.text}`).join('\n') + '\n')
+  }, 100)
+  timer.unref?.()
+}
+
 class Impit extends native.Impit {
   constructor(options) {
-    const jsCookieJar = options?.cookieJar
+    // The native side rejects keys it does not know, so JS-only ones stay here.
+    const { cookieJar: jsCookieJar, ...nativeOptions } = options ?? {}
     super({
-      ...options,
+      ...nativeOptions,
       headers: headersToObject(options?.headers),
     })
     this._jsCookieJar = jsCookieJar
+    if (options?.verbose || options?.debug) startTracePrinter(this)
+  }
+  group(options) {
+    const group = super.group(options)
+    group.fetch = (resource, init) => this.fetch(resource, { ...init, group })
+    return group
+  }
+  // Descriptors go to the native side untouched; only the shared options
+  // are normalized here. The JS cookieJar hooks are not consulted.
+  fetchMany(requests, options) {
+    return super.fetchMany(requests, options?.headers ? { ...options, headers: canonicalizeHeaders(options.headers) } : options)
+  }
+  // A child identity on this client's engine: its own cookies, proxy and
+  // headers, sharing connections and DNS/TLS caches with the parent.
+  session(options) {
+    return super.session(options?.headers ? { ...options, headers: canonicalizeHeaders(options.headers) } : options)
+  }
+  runJobFile(inPath, outPath, options) {
+    return super.runJobFile(inPath, outPath, options?.headers ? { ...options, headers: canonicalizeHeaders(options.headers) } : options)
+  }
+  // Promise-free fetch for high request rates. init goes to the native side
+  // as is (string or Buffer body), so there is no per-request async step and
+  // the JS cookieJar hooks are not consulted. Returns the request id.
+  fetchCallback(url, init, callback) {
+    if (typeof init === 'function') {
+      callback = init
+      init = undefined
+    }
+    if (typeof Headers !== 'undefined' && init?.headers instanceof Headers) init = { ...init, headers: canonicalizeHeaders(init.headers) }
+    return super.fetch(String(url), init ?? {}, callback)
   }
   async fetch(resource, init) {
+    // A compiled profile goes to the native fetch as is.
+    if (init instanceof native.ImpitProfile) return super.fetch(String(resource), init)
     const { url, signal, ...options } = await parseFetchOptions(resource, init)
     if (this._jsCookieJar) {
       try {
         const cookieStr = await this._jsCookieJar.getCookieString?.(url)
-        if (cookieStr && !options.headers.some(([k]) => String(k).toLowerCase() === 'cookie')) {
-          options.headers.push(['Cookie', cookieStr])
+        if (cookieStr && !hasHeader(options.headers, 'cookie')) {
+          options.headers = withHeader(options.headers, 'Cookie', cookieStr)
         }
       } catch {}
     }
-    const waitForAbort = new Promise((_, reject) => {
-      signal?.throwIfAborted?.()
-      signal?.addEventListener?.('abort', () => reject(signal.reason), { once: true })
-    })
-    const response = super.fetch(url, options)
-    const originalResponse = await Promise.race([response, waitForAbort])
+    // The native fetch listens on the signal itself and drops the transfer
+    // from the engine when it fires.
     signal?.throwIfAborted?.()
-    signal?.addEventListener?.('abort', () => { originalResponse.abort() })
-    const rawHeaders = originalResponse.headers
-    if (typeof Headers !== 'undefined') {
-      Object.defineProperty(originalResponse, 'headers', { value: new Headers(originalResponse.headers) })
-    }
-    if (this._jsCookieJar && Array.isArray(rawHeaders)) {
+    if (!Buffer.isBuffer(options.headers)) options.headers = options.headers.flat()
+    const originalResponse = await super.fetch(url, signal ? { ...options, signal } : options)
+    signal?.throwIfAborted?.()
+    signal?.addEventListener?.('abort', () => { originalResponse.abort(signal.reason) }, { once: true })
+    if (this._jsCookieJar) {
       try {
-        for (const [k, v] of rawHeaders) {
-          if (String(k).toLowerCase() === 'set-cookie') {
-            await this._jsCookieJar.setCookie?.(v, url)
-          }
+        for (const v of originalResponse.headers.getSetCookie()) {
+          await this._jsCookieJar.setCookie?.(v, url)
         }
       } catch {}
     }
@@ -95,11 +164,22 @@ class Impit extends native.Impit {
   }
 }
 
+// Session fetches take the same inputs as Impit#fetch. The parent's
+// cookieJar hooks are not consulted; sessions keep their own cookies.
+const sessionFetch = native.ImpitSession.prototype.fetch
+native.ImpitSession.prototype.fetch = async function fetch(resource, init) {
+  const { url, signal, ...options } = await parseFetchOptions(resource, init)
+  if (!Buffer.isBuffer(options.headers)) options.headers = options.headers.flat()
+  return sessionFetch.call(this, url, signal ? { ...options, signal } : options)
+}
+
 module.exports.Impit = Impit
 module.exports.ImpitWrapper = native.ImpitWrapper
-// ImpitResponse is an interface in TypeScript, not a runtime class. 
-// We export a dummy object for compatibility if needed, but it's not strictly required at runtime.
-module.exports.ImpitResponse = class ImpitResponse {} 
+module.exports.ImpitResponse = native.ImpitResponse
+module.exports.ImpitHeaders = native.ImpitHeaders
+module.exports.ImpitProfile = native.ImpitProfile
+module.exports.ImpitSession = native.ImpitSession
+module.exports.encodeHeaders = encodeHeaders
 module.exports.Browser = {
   Chrome: 'chrome',
   Firefox: 'firefox',
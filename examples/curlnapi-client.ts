@@ -150,17 +150,11 @@ export class CurlNapiHttpClient implements BaseHttpClient {
 
         if (debug) {
             console.log('[curlnapi] response status', response.status, response.url);
-            if (response.headers instanceof Headers) {
-                console.log('[curlnapi] response headers', Object.fromEntries(response.headers.entries()));
-            } else if (Array.isArray(response.headers)) {
-                console.log('[curlnapi] response headers', Object.fromEntries(response.headers));
-            }
+            console.log('[curlnapi] response headers', Object.fromEntries(response.headers.entries()));
         }
 
         if (this.followRedirects && response.status >= 300 && response.status < 400) {
-            const location = response.headers instanceof Headers 
-                ? response.headers.get('location') 
-                : (Array.isArray(response.headers) ? response.headers.find(x => x[0].toLowerCase() === 'location')?.[1] : null);
+            const location = response.headers.get('location');
 
             const redirectUrl = new URL(location ?? '', request.url);
 